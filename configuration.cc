@@ -4,221 +4,691 @@
 ******/
 
 #include "configuration.hh"
+#include "count_codec.hh"
+#include <algorithm>
 
-//Internal storage for a configuration space
+//How config_node stores its probability; see count_codec.hh.  -DCONFIG_PROB_CODEC=log_prob16_codec halves it.
+#ifndef CONFIG_PROB_CODEC
+#define CONFIG_PROB_CODEC exact_codec
+#endif
+typedef CONFIG_PROB_CODEC config_prob_codec;
+
+//Internal storage for a configuration space.  Nodes are handed out by the arena, never by new.
 class config_node {
 public:
-  config_node(config_node* super, double prob, event e) {
-    if(super == NULL && e.t != 0)
+  void init(cn_index super, double prob, event e) {
+    if(super == CN_NULL && e.t != 0)
       cout << "ERROR: first event in configuration space not at t=0";      
-    
+
     this->super = super;
-    sub_given = NULL;
-    sub_complement = NULL;
-    this->last_calculated_prob = prob;
+    subs = CN_NULL;
+    last_calculated_prob = prob;
     prob_needs_update = false;
-    this->e = e;
+    t = e.t;
+    p = e.p;
+    heap_index = -1;
+    heap_serial = 0;
+    on_givens_path = false;
+    pruned = false;
   }
 
-  void expand(int t, double given_prob, double complement_prob) {
-    free_subs(); //just in case we are trying to do something wierd
-    sub_given = new config_node(this, given_prob, event(t, 1));
-    sub_complement = new config_node(this, complement_prob, event(t, 0));
-    invalidate_prob();
+  event e() const {
+    return event(t, p);
   }
 
-  bool expanded() const {
-    return (sub_given != NULL && sub_complement != NULL);
+private:
+  quantized<config_prob_codec> last_calculated_prob;
+  cn_index super;
+  cn_index subs; //the given is subs, the complement is subs + 1
+  int heap_index; //place in the leaf frontier, or -1
+  unsigned heap_serial; //order of insertion into the frontier, to break ties
+  int t;
+  bool p;
+  bool prob_needs_update;
+  bool on_givens_path;
+  bool pruned; //a leaf that is out of the frontier for good
+  friend class config_arena;
+  friend class leaf_frontier;
+  friend class configuration_space;
+};
+
+
+//Member functions of the arena
+config_arena::config_arena() {
+  next_unused = 0;
+  free_pairs = CN_NULL;
+  num_free_pairs = 0;
+}
+
+config_arena::~config_arena() {
+  for(config_node* slab : slabs)
+    delete[] slab;
+}
+
+//CONFIG_SLAB_SIZE is even, so a pair never straddles two slabs.
+cn_index config_arena::alloc_pair() {
+  if(free_pairs != CN_NULL) {
+    cn_index first = free_pairs;
+    free_pairs = (*this)[first].super;
+    num_free_pairs--;
+    return first;
   }
 
-  void invalidate_prob() {
-    prob_needs_update = true;
-    if(super != NULL)
-      super->invalidate_prob();
+  if(next_unused >> CONFIG_SLAB_BITS == slabs.size())
+    slabs.push_back(new config_node[CONFIG_SLAB_SIZE]);
+  cn_index first = next_unused;
+  next_unused += 2;
+  return first;
+}
+
+void config_arena::free_pair(cn_index first) {
+  (*this)[first].super = free_pairs;
+  free_pairs = first;
+  num_free_pairs++;
+}
+
+config_node& config_arena::operator[](cn_index n) {
+  return slabs[n >> CONFIG_SLAB_BITS][n & (CONFIG_SLAB_SIZE - 1)];
+}
+
+const config_node& config_arena::operator[](cn_index n) const {
+  return slabs[n >> CONFIG_SLAB_BITS][n & (CONFIG_SLAB_SIZE - 1)];
+}
+
+unsigned config_arena::live_count() const {
+  return next_unused - 2*num_free_pairs;
+}
+
+unsigned long config_arena::memory_used() const {
+  return sizeof(config_arena) + slabs.capacity()*sizeof(config_node*) + slabs.size()*CONFIG_SLAB_SIZE*sizeof(config_node);
+}
+
+
+//Member functions of the leaf frontier
+leaf_frontier::leaf_frontier(config_arena& nodes) : nodes(nodes) {
+  next_serial = 0;
+}
+
+bool leaf_frontier::higher(cn_index n1, cn_index n2) const {
+  double p1 = nodes[n1].last_calculated_prob;
+  double p2 = nodes[n2].last_calculated_prob;
+  return (p1 > p2 || (p1 == p2 && nodes[n1].heap_serial > nodes[n2].heap_serial));
+}
+
+void leaf_frontier::place(unsigned i, cn_index n) {
+  heap[i] = n;
+  nodes[n].heap_index = i;
+}
+
+void leaf_frontier::sift_up(unsigned i) {
+  cn_index n = heap[i];
+  while(i > 0 && higher(n, heap[(i - 1)/2])) {
+    place(i, heap[(i - 1)/2]);
+    i = (i - 1)/2;
   }
-  
-  void free_subs() {
-    if(sub_given != NULL) {
-      sub_given->free_subs();
-      delete sub_given;
-    }
-    if(sub_complement != NULL) {
-      sub_complement->free_subs();
-      delete sub_complement;
-    }
+  place(i, n);
+}
 
-    sub_given = NULL;
-    sub_complement = NULL;
+void leaf_frontier::sift_down(unsigned i) {
+  cn_index n = heap[i];
+  while(true) {
+    unsigned child = 2*i + 1;
+    if(child >= heap.size())
+      break;
+    if(child + 1 < heap.size() && higher(heap[child + 1], heap[child]))
+      child++;
+    if(!higher(heap[child], n))
+      break;
+    place(i, heap[child]);
+    i = child;
   }
-  
-  //Note the assumption that the first event is at t=0 and all other events have t_offset relative to that
-  pattern givens() const { //Not the most efficient way to write this
-    if(super != NULL)
-      return get_union(super->givens(), e.t, pattern(e.p));
-    else
-      return pattern(e.p);
+  place(i, n);
+}
+
+void leaf_frontier::insert(cn_index n) {
+  nodes[n].heap_serial = next_serial++;
+  heap.push_back(n);
+  sift_up(heap.size() - 1);
+}
+
+void leaf_frontier::remove(cn_index n) {
+  if(nodes[n].heap_index < 0)
+    return;
+
+  unsigned i = nodes[n].heap_index;
+  nodes[n].heap_index = -1;
+  cn_index last = heap.back();
+  heap.pop_back();
+  if(i < heap.size()) {
+    place(i, last);
+    update(last);
   }
+}
 
-  double prob() {
-    if(prob_needs_update) {
-      last_calculated_prob = 0.0; //so there is no path where prob is undefined
-      if(expanded())
-	last_calculated_prob = sub_given->prob() + sub_complement->prob();
-      
-      prob_needs_update = false;
-    }
-  
-    return last_calculated_prob;
+void leaf_frontier::update(cn_index n) {
+  sift_up(nodes[n].heap_index);
+  sift_down(nodes[n].heap_index);
+}
+
+void leaf_frontier::lowest(unsigned count, vector<cn_index>& leaves) const {
+  leaves = heap;
+  count = min(count, unsigned(leaves.size()));
+  auto p_split = leaves.begin() + (leaves.size() - count);
+  nth_element(leaves.begin(), p_split, leaves.end(), [this](cn_index n1, cn_index n2) { return higher(n1, n2); });
+  leaves.erase(leaves.begin(), p_split);
+}
+
+cn_index leaf_frontier::top() const {
+  if(heap.empty())
+    return CN_NULL;
+  return heap.front();
+}
+
+
+//Member functions of the completion cache
+completion_cache::completion_cache(unsigned max_entries) {
+  this->max_entries = max_entries;
+}
+
+bool completion_cache::find(const pattern& givens, completion_set& cmp) {
+  auto p_entry = index.find(givens);
+  if(p_entry == index.end())
+    return false;
+
+  entries.splice(entries.begin(), entries, p_entry->second);
+  cmp = p_entry->second->second;
+  return true;
+}
+
+void completion_cache::insert(const pattern& givens, const completion_set& cmp) {
+  if(max_entries == 0)
+    return;
+
+  auto p_entry = index.find(givens);
+  if(p_entry != index.end()) {
+    p_entry->second->second = cmp;
+    entries.splice(entries.begin(), entries, p_entry->second);
+    return;
   }
 
-  double sub_event_cond_prob() { //returns the conditional probability of the topmost event in the tree.
-    double p = prob();
+  entries.push_front(make_pair(givens, cmp));
+  index[givens] = entries.begin();
+  if(entries.size() > max_entries) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+  }
+}
 
-    if(p == 0.0)
-      return p;
-    
-    if(expanded())
-      return sub_given->prob()/p;
+void completion_cache::invalidate() {
+  index.clear();
+  entries.clear();
+}
 
-    return 0.0;
+void completion_cache::resize(unsigned max_entries) {
+  this->max_entries = max_entries;
+  while(entries.size() > max_entries) {
+    index.erase(entries.back().first);
+    entries.pop_back();
   }
+}
+
+
+//Operations on the nodes of the configuration space
+bool configuration_space::expanded(cn_index n) const {
+  return nodes[n].subs != CN_NULL;
+}
 
-  event sub_event() const {
-    if(expanded())
-      return sub_given->e;
-    else {
-      event bogus;
-      return bogus;
+void configuration_space::expand(cn_index n, int t, double given_prob, double complement_prob) {
+  free_subs(n); //just in case we are trying to do something wierd
+  frontier.remove(n);
+  cn_index subs = nodes.alloc_pair();
+  nodes[subs].init(n, given_prob, event(t, 1));
+  nodes[subs + 1].init(n, complement_prob, event(t, 0));
+  nodes[n].subs = subs;
+  frontier.insert(subs);
+  frontier.insert(subs + 1);
+  invalidate_prob(n);
+
+  if(beam_min_relative_prob > 0.0) {
+    double threshold = beam_min_relative_prob*prob(root_node);
+    for(cn_index sub = subs;sub < subs + 2;sub++) {
+      if(prob(sub) < threshold)
+	prune(sub);
     }
   }
-  
-  //mark the event as probability zero
-  config_node* choose_complement() {
-    if(expanded()) {
-      sub_given->free_subs();
-      sub_given->last_calculated_prob = 0.0;
-      sub_given->prob_needs_update = false;
-      invalidate_prob();
-      return sub_complement;
+}
+
+//Every ancestor of a node that needs an update needs one too, so the walk up can stop at the first that already does.
+//That keeps a run of expansions under one branch O(1) each, rather than O(depth).
+void configuration_space::invalidate_prob(cn_index n) {
+  for(;n != CN_NULL && !nodes[n].prob_needs_update;n = nodes[n].super)
+    nodes[n].prob_needs_update = true;
+}
+
+//Leaves below this node come out of the frontier; this node is left a leaf, and the caller decides whether it goes in.
+//The subtree goes back to the arena a pair at a time, without recursing, so a deep tree cannot overflow the stack.
+void configuration_space::free_subs(cn_index n) {
+  if(!expanded(n))
+    return;
+  if(nodes[n].on_givens_path)
+    pop_givens_path(n); //nothing on the cached path may outlive its node
+
+  release_stack.clear();
+  release_stack.push_back(nodes[n].subs);
+  nodes[n].subs = CN_NULL;
+  while(!release_stack.empty()) {
+    cn_index pair = release_stack.back();
+    release_stack.pop_back();
+    for(cn_index sub = pair;sub < pair + 2;sub++) {
+      frontier.remove(sub);
+      if(expanded(sub))
+	release_stack.push_back(nodes[sub].subs);
     }
-    return NULL;
+    nodes.free_pair(pair);
   }
+}
+
+//Note the assumption that the first event is at t=0 and all other events have t_offset relative to that.
+//Climbs from n only as far as the path cached from the last call, then swaps the part of the path below that for
+//the part leading to n.  A child of the last node usually comes after all its givens, and is appended in O(1).
+const pattern& configuration_space::givens(cn_index n) {
+  givens_climb.clear();
+  for(;n != CN_NULL && !nodes[n].on_givens_path;n = nodes[n].super)
+    givens_climb.push_back(n);
+  pop_givens_path(n);
+
+  for(auto p_climb = givens_climb.rbegin();p_climb != givens_climb.rend();++p_climb) {
+    config_node& node = nodes[*p_climb];
+    node.on_givens_path = true;
+    givens_path.push_back(*p_climb);
 
-  //Mark the complement as probability zero
-  config_node* choose_event() {
-    if(expanded()) {
-      sub_complement->free_subs();
-      sub_complement->last_calculated_prob = 0.0;
-      sub_complement->prob_needs_update = false;
-      invalidate_prob();
-      return sub_given;
+    event e = node.e();
+    if(path_events.empty() || path_events.back() < e) {
+      if(!givens_dirty)
+	path_givens.append(e.p, (path_events.empty() ? 0 : e.t - path_events.back().t));
+      path_events.push_back(e);
+    } else {
+      path_events.insert(upper_bound(path_events.begin(), path_events.end(), e), e);
+      givens_dirty = true;
     }
-    return NULL;
   }
 
-  config_node* highest_probability_leaf_node() { //dummy so that we can have a reference to a default value
-    double best = 0.0;
-    return highest_probability_leaf_node(best);
+  if(givens_dirty) { //the same as taking the union of every event on the path
+    path_givens.p.clear();
+    path_givens.dt.clear();
+    for(unsigned i = 0;i < path_events.size();i++) {
+      if(i > 0 && path_events[i] == path_events[i - 1])
+	continue;
+      path_givens.append(path_events[i].p, (i == 0 ? 0 : path_events[i].t - path_events[i - 1].t));
+    }
+    givens_dirty = false;
   }
-  
-  config_node* highest_probability_leaf_node(double &current_best) {
-    if(prob() < current_best)
-      return NULL;
-    else {
-      config_node* best_node = NULL;
-      if(expanded()) {
-	config_node* given_best_node = sub_given->highest_probability_leaf_node(current_best);
-	if(given_best_node != NULL)
-	  best_node = given_best_node;
-	config_node* excl_best_node = sub_complement->highest_probability_leaf_node(current_best);
-	if(excl_best_node != NULL)
-	  best_node = excl_best_node;
-	
-      } else {
-	best_node = this;
-	current_best = prob();
+
+  return path_givens;
+}
+
+//Completions give their t relative to the first event of the givens, which is only t=0 while the whole history is kept
+int configuration_space::givens_origin() const {
+  return (path_events.empty() ? 0 : path_events.front().t);
+}
+
+//Cuts the cached path back to keep, or to nothing if keep is not on it
+void configuration_space::pop_givens_path(cn_index keep) {
+  while(!givens_path.empty() && givens_path.back() != keep) {
+    config_node& node = nodes[givens_path.back()];
+    node.on_givens_path = false;
+    path_events.erase(lower_bound(path_events.begin(), path_events.end(), node.e()));
+    givens_path.pop_back();
+    givens_dirty = true;
+  }
+}
+
+//Recalculates bottom up, only below nodes that need it, from an explicit stack rather than by recursing.
+//A node is summed once both its subs are up to date; until then it stays on the stack under them.
+double configuration_space::prob(cn_index n) const {
+  if(nodes[n].prob_needs_update) {
+    prob_stack.clear();
+    prob_stack.push_back(n);
+    while(!prob_stack.empty()) {
+      cn_index m = prob_stack.back();
+      config_node& node = nodes[m];
+      if(!node.prob_needs_update) {
+	prob_stack.pop_back();
+	continue;
+      }
+
+      node.last_calculated_prob = 0.0; //so there is no path where prob is undefined
+      if(expanded(m)) {
+	bool subs_ready = true;
+	for(cn_index sub = node.subs;sub < node.subs + 2;sub++) {
+	  if(nodes[sub].prob_needs_update) {
+	    prob_stack.push_back(sub);
+	    subs_ready = false;
+	  }
+	}
+	if(!subs_ready)
+	  continue;
+	node.last_calculated_prob = nodes[node.subs].last_calculated_prob + nodes[node.subs + 1].last_calculated_prob;
       }
-      
-      return best_node;
+
+      node.prob_needs_update = false;
+      prob_stack.pop_back();
     }
   }
 
-  void print(unsigned tab_layers = 0) {
-    if(expanded())
+  return nodes[n].last_calculated_prob;
+}
+
+double configuration_space::sub_event_cond_prob(cn_index n) const { //returns the conditional probability of the topmost event in the tree.
+  double p = prob(n);
+
+  if(p == 0.0)
+    return p;
+
+  if(expanded(n))
+    return prob(nodes[n].subs)/p;
+
+  return 0.0;
+}
+
+event configuration_space::sub_event(cn_index n) const {
+  if(expanded(n))
+    return nodes[nodes[n].subs].e();
+  else {
+    event bogus;
+    return bogus;
+  }
+}
+
+//The chosen-against side becomes a leaf of probability zero.  It stays in the frontier, so it can still be
+//expanded once nothing better is left, as before.
+void configuration_space::zero_out(cn_index n) {
+  free_subs(n);
+  nodes[n].last_calculated_prob = 0.0;
+  nodes[n].prob_needs_update = false;
+  if(nodes[n].pruned)
+    return;
+  if(nodes[n].heap_index < 0)
+    frontier.insert(n);
+  else
+    frontier.update(n);
+}
+
+//Makes the fulcrum the root.  Every node above it goes, and so does every branch off the path down to it, since the
+//events on that path have all been chosen.  Nodes keep their t, so the t of the root is no longer 0.
+//The fulcrum shares a pair with its dead sibling, which stays allocated, childless and out of the frontier until the
+//fulcrum itself is freed.
+void configuration_space::reroot() {
+  pop_givens_path(CN_NULL); //the path is rebuilt from the new root on the next call
+  path_events.clear();
+
+  cn_index child = fulcrum_node;
+  cn_index super = nodes[child].super;
+  while(super != CN_NULL) {
+    cn_index sibling = child ^ 1; //the other half of the pair
+    free_subs(sibling);
+    frontier.remove(sibling);
+    history.push_back(nodes[super].e());
+
+    cn_index next = nodes[super].super;
+    if(child != fulcrum_node)
+      nodes.free_pair(child & ~1u);
+    child = super;
+    super = next;
+  }
+  if(child != fulcrum_node)
+    nodes.free_pair(child & ~1u); //the old root; its other half, if it has one, was dealt with when it was re-rooted
+  nodes[fulcrum_node].super = CN_NULL;
+  root_node = fulcrum_node;
+
+  sort(history.begin(), history.end());
+  if(history_horizon != INT_MAX) {
+    //keep the givens at most history_horizon ticks before the new root, the one exactly that far back included
+    long long cutoff = (long long)nodes[root_node].t - history_horizon;
+    auto p_keep = history.begin();
+    while(p_keep != history.end() && p_keep->t < cutoff)
+      ++p_keep;
+    history.erase(history.begin(), p_keep);
+  }
+  path_events = history;
+  givens_dirty = true;
+}
+
+//Keep the event (p true) or its complement, marking the other side as probability zero.  Returns the side kept.
+cn_index configuration_space::choose(cn_index n, bool p) {
+  if(!expanded(n))
+    return CN_NULL;
+
+  cn_index kept = (p ? nodes[n].subs : nodes[n].subs + 1);
+  zero_out(p ? nodes[n].subs + 1 : nodes[n].subs);
+  invalidate_prob(n);
+  if(nodes[kept].pruned) { //what actually happened was pruned as unlikely; it needs to grow again
+    nodes[kept].pruned = false;
+    frontier.insert(kept);
+  }
+  return kept;
+}
+
+//True for the fulcrum and the nodes above it, which are never pruned
+bool configuration_space::resolved(cn_index n) const {
+  for(cn_index m = fulcrum_node;m != CN_NULL;m = nodes[m].super) {
+    if(m == n)
+      return true;
+  }
+  return false;
+}
+
+//Takes a leaf out of the frontier, then frees every pair above it that has been pruned on both sides
+void configuration_space::prune(cn_index leaf) {
+  if(leaf == fulcrum_node || nodes[leaf].pruned)
+    return;
+  frontier.remove(leaf);
+  nodes[leaf].pruned = true;
+
+  cn_index n = leaf;
+  cn_index super = nodes[n].super;
+  while(super != CN_NULL && nodes[n ^ 1].pruned && !resolved(super)) {
+    double mass = prob(n) + prob(n ^ 1);
+    free_subs(super);
+    nodes[super].last_calculated_prob = mass;
+    nodes[super].prob_needs_update = false;
+    nodes[super].pruned = true;
+    n = super;
+    super = nodes[n].super;
+  }
+  if(n != leaf && super != CN_NULL)
+    invalidate_prob(super); //in case the codec rounds the sum differently
+}
+
+//Prunes down to an eighth under the limit, so the O(N) pass comes around once every max_leaves/8 expansions
+void configuration_space::trim_frontier() {
+  unsigned target = beam_max_leaves - beam_max_leaves/8;
+  frontier.lowest(frontier.size() - target, beam_scratch);
+  for(cn_index leaf : beam_scratch)
+    prune(leaf);
+}
+
+//Depth first, the given before the complement, from an explicit stack so a deep tree cannot overflow the call stack
+void configuration_space::print(cn_index n, unsigned tab_layers) {
+  vector< pair<cn_index, unsigned> > to_print;
+  to_print.push_back(make_pair(n, tab_layers));
+  while(!to_print.empty()) {
+    n = to_print.back().first;
+    tab_layers = to_print.back().second;
+    to_print.pop_back();
+
+    if(expanded(n))
       cout << "-->";
     else
       cout << "   ";
-  
-    cout << setw(12) << prob() << "\t";
+
+    cout << setw(12) << prob(n) << "\t";
     cout << "Given:\t";
     for(unsigned i = 0;i < tab_layers;i++)
       cout << "\t";
-    print_pattern(givens());
+    print_pattern(givens(n));
     cout << endl;
-    
-    if(expanded()) {
-      sub_given->print(tab_layers + 1);
-      sub_complement->print(tab_layers + 1);
-    }	
+
+    if(expanded(n)) {
+      to_print.push_back(make_pair(nodes[n].subs + 1, tab_layers + 1));
+      to_print.push_back(make_pair(nodes[n].subs, tab_layers + 1));
+    }
   }
-  
-private:
-  double last_calculated_prob;
-  bool prob_needs_update;
-  config_node* sub_given;
-  config_node* sub_complement;
-  config_node* super;
-  event e;
-};
+}
 
 
 //Member functions of the configuration space
-configuration_space::configuration_space() {
-  root_node = new config_node(NULL, 1.0, event(0, 1));
+//The root takes a whole pair to itself, so every node in the arena is part of one.
+configuration_space::configuration_space() : frontier(nodes), completions(0) {
+  root_node = nodes.alloc_pair();
+  nodes[root_node].init(CN_NULL, 1.0, event(0, 1));
   fulcrum_node = root_node;
+  frontier.insert(root_node);
+  givens_dirty = false;
+  history_horizon = -1;
+  beam_max_leaves = 0;
+  beam_min_relative_prob = 0.0;
+  expansion_pool = NULL;
+  leaves_per_round = 1;
 }
 
 configuration_space::~configuration_space() {
-  root_node->free_subs();
-  delete root_node;
+  delete expansion_pool;
 }
 
 void configuration_space::choose_event() {  //Make the given node the root node
-  if(fulcrum_node->expanded())
-    fulcrum_node = fulcrum_node->choose_event();
+  if(expanded(fulcrum_node)) {
+    fulcrum_node = choose(fulcrum_node, true);
+    if(history_horizon >= 0)
+      reroot();
+  }
 }
 
 void configuration_space::choose_complement() { //Mark the given as prob=0.00 and the complement as 1.00 without invalidating the whole tree
-  if(fulcrum_node->expanded())
-    fulcrum_node = fulcrum_node->choose_complement();
+  if(expanded(fulcrum_node)) {
+    fulcrum_node = choose(fulcrum_node, false);
+    if(history_horizon >= 0)
+      reroot();
+  }
 }
 
 double configuration_space::next_event_cond_prob() const { //conditional probability
-  return fulcrum_node->sub_event_cond_prob();
+  return sub_event_cond_prob(fulcrum_node);
 }
 
 event configuration_space::next_event() const {
-  if(!fulcrum_node->expanded())
+  if(!expanded(fulcrum_node))
     cout << "ERROR: fulcrum node is not expanded; no next event to return.\n";
   
-  return fulcrum_node->sub_event();
+  return sub_event(fulcrum_node);
 }
 
 bool configuration_space::next_event_ready() const {
-  return fulcrum_node->expanded();
+  return expanded(fulcrum_node);
+}
+
+//Reading the clock costs far less than an expansion, but still something, so it is read only every so many
+//expansions.  The stride is set from how long expansions have been taking, so that the next reading comes well
+//before the deadline: the deadline can be overrun by at most about a quarter of the time left at the last reading,
+//or by one expansion (or one round).
+const unsigned PREDICT_MAX_CLOCK_STRIDE = 64;
+
+predict_deadline::predict_deadline(double time_limit) {
+  timed = (time_limit > 0.0);
+  start = clock::now();
+  deadline = start + chrono::duration_cast<clock::duration>(chrono::duration<double>(time_limit));
+  next_reading = 1;
 }
 
-void configuration_space::predict(unsigned max_events, double predict_time_limit, function<completion_set(const pattern&)> get_first_order_completions) {
-  for(unsigned i=0;i<max_events;i++) { //FIXME: Insert timing code.
-    config_node* best_node = root_node->highest_probability_leaf_node();
-    completion_set cmp = get_first_order_completions(best_node->givens());
-    best_node->expand(cmp.t_offset, cmp.event_prob, cmp.complement_prob);
+bool predict_deadline::passed(unsigned expansions) {
+  if(!timed || expansions < next_reading)
+    return false;
+
+  clock::time_point now = clock::now();
+  if(now >= deadline)
+    return true;
+
+  double per_expansion = chrono::duration<double>(now - start).count()/expansions;
+  double stride = chrono::duration<double>(deadline - now).count()/4/per_expansion;
+  next_reading = expansions + unsigned(max(1.0, min(stride, double(PREDICT_MAX_CLOCK_STRIDE))));
+  return false;
+}
+
+//Takes the best leaves out of the frontier first, so the leaves expanded are the ones that were best at the start of
+//the round; a child made this round waits for the next one even if it would beat the last leaf taken.
+//Completions found in the cache go straight into round_completions; the rest are left for the caller to fill in
+//round_answers from round_givens.
+unsigned configuration_space::begin_round(unsigned max_leaves) {
+  round_leaves.clear();
+  while(round_leaves.size() < max_leaves && frontier.size() > 0) {
+    round_leaves.push_back(frontier.top());
+    frontier.remove(frontier.top());
   }
+
+  unsigned num_leaves = round_leaves.size();
+  round_origins.resize(num_leaves);
+  round_completions.resize(num_leaves);
+  round_misses.clear();
+  for(unsigned i = 0;i < num_leaves;i++) {
+    const pattern& leaf_givens = givens(round_leaves[i]);
+    round_origins[i] = givens_origin();
+    if(!completions.find(leaf_givens, round_completions[i])) {
+      round_misses.push_back(i);
+      if(round_givens.size() < round_misses.size())
+	round_givens.resize(round_misses.size());
+      round_givens[round_misses.size() - 1] = leaf_givens; //a copy, since the cached path only holds one set of givens
+    }
+  }
+  round_answers.resize(max(round_answers.size(), round_misses.size()));
+  return num_leaves;
 }
 
-void configuration_space::display_contents() {
-  root_node->print();
+//Expands the round's leaves in the order they were taken
+void configuration_space::end_round() {
+  for(unsigned j = 0;j < round_misses.size();j++) {
+    round_completions[round_misses[j]] = round_answers[j];
+    completions.insert(round_givens[j], round_answers[j]);
+  }
+
+  for(unsigned i = 0;i < round_leaves.size();i++)
+    expand(round_leaves[i], round_origins[i] + round_completions[i].t_offset, round_completions[i].event_prob, round_completions[i].complement_prob);
 }
 
+void configuration_space::end_expansion() {
+  if(beam_max_leaves > 0 && frontier.size() > beam_max_leaves)
+    trim_frontier();
+}
 
+void configuration_space::set_completion_cache_size(unsigned max_entries) {
+  completions.resize(max_entries);
+}
 
+void configuration_space::invalidate_completions() {
+  completions.invalidate();
+}
+
+void configuration_space::set_history_horizon(int horizon) {
+  history_horizon = horizon;
+  if(history_horizon >= 0)
+    reroot();
+}
+
+void configuration_space::set_beam(unsigned max_leaves, double min_relative_prob) {
+  beam_max_leaves = max_leaves;
+  beam_min_relative_prob = min_relative_prob;
+  if(beam_max_leaves > 0 && frontier.size() > beam_max_leaves)
+    trim_frontier();
+}
+
+void configuration_space::set_expansion_threads(unsigned num_threads, unsigned leaves_per_round) {
+  delete expansion_pool;
+  expansion_pool = (num_threads > 0 ? new task_pool(num_threads) : NULL);
+  if(expansion_pool == NULL)
+    this->leaves_per_round = 1;
+  else
+    this->leaves_per_round = (leaves_per_round > 0 ? leaves_per_round : num_threads);
+}
+
+void configuration_space::display_contents() {
+  print(root_node);
+}
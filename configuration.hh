@@ -4,8 +4,15 @@
 ******/
 
 #include "pattern.hh"
+#include "task_pool.hh"
 #include <iostream>
 #include <iomanip>
+#include <vector>
+#include <climits>
+#include <chrono>
+#include <list>
+#include <unordered_map>
+#include <algorithm>
 
 using namespace std;
 
@@ -14,6 +21,92 @@ using namespace std;
 
 class config_node;
 
+//Config nodes are addressed by their index in the arena.  32 bits is plenty and half the size of a pointer.
+typedef unsigned cn_index;
+const cn_index CN_NULL = UINT_MAX;
+
+/*
+  Storage for the nodes of a configuration tree.  Nodes live in slabs of CONFIG_SLAB_SIZE, so they never move and an
+  index stays good for as long as the node is alive.  The two children of a node are always allocated together, as an
+  adjacent pair, so a node needs only the one index to reach both.  Freed pairs go on a free list and are handed out
+  again before the arena grows.  The slabs themselves are only freed with the arena, so a long running predictor
+  reuses the same memory instead of fragmenting the heap.
+*/
+const unsigned CONFIG_SLAB_BITS = 12;
+const unsigned CONFIG_SLAB_SIZE = 1 << CONFIG_SLAB_BITS;
+
+class config_arena {
+public:
+  config_arena();
+  ~config_arena();
+  cn_index alloc_pair(); //returns the first of two adjacent nodes
+  void free_pair(cn_index first);
+  config_node& operator[](cn_index n);
+  const config_node& operator[](cn_index n) const;
+  unsigned live_count() const; //nodes in pairs that have been allocated and not freed
+  unsigned long memory_used() const;
+private:
+  config_arena(const config_arena&); //not copyable
+  vector<config_node*> slabs;
+  cn_index next_unused; //first index never handed out
+  cn_index free_pairs; //head of the free list, which is linked through the super index of each pair's first node
+  unsigned num_free_pairs;
+};
+
+//Every leaf of the tree in an indexed max-heap keyed by probability, so the best leaf to expand is always on top.
+//Each node knows its place in the heap, so a leaf whose probability changes, or which stops being a leaf, is moved
+//or taken out in O(log N).  Equal probabilities go to the leaf added last.
+class leaf_frontier {
+public:
+  leaf_frontier(config_arena& nodes);
+  void insert(cn_index n);
+  void remove(cn_index n);
+  void update(cn_index n); //call after the probability of n has changed
+  cn_index top() const; //CN_NULL if there are no leaves
+  unsigned size() const { return heap.size(); }
+  void lowest(unsigned count, vector<cn_index>& leaves) const; //the count lowest leaves, in no particular order
+private:
+  bool higher(cn_index n1, cn_index n2) const;
+  void place(unsigned i, cn_index n);
+  void sift_up(unsigned i);
+  void sift_down(unsigned i);
+  config_arena& nodes;
+  vector<cn_index> heap;
+  unsigned next_serial;
+};
+
+/*
+  Completions already asked for, keyed by the givens.  Patterns only hold relative times, and so do completions, so
+  the same givens reached down another path or at a later t still hit.  Least recently used entries are evicted once
+  the cache is full.  A cache of size zero holds nothing.
+*/
+class completion_cache {
+public:
+  completion_cache(unsigned max_entries);
+  bool find(const pattern& givens, completion_set& cmp);
+  void insert(const pattern& givens, const completion_set& cmp);
+  void invalidate();
+  void resize(unsigned max_entries);
+private:
+  typedef list< pair<pattern, completion_set> > lru_list;
+  unsigned max_entries;
+  lru_list entries; //most recently used at the front
+  unordered_map<pattern, lru_list::iterator, pattern_hash> index;
+};
+
+//Tells predict when its time is up.  See configuration.cc for how often it reads the clock.
+class predict_deadline {
+public:
+  predict_deadline(double time_limit); //in seconds; zero or less for no limit
+  bool passed(unsigned expansions); //expansions is how many have been done so far
+private:
+  typedef chrono::steady_clock clock;
+  bool timed;
+  clock::time_point start;
+  clock::time_point deadline;
+  unsigned next_reading;
+};
+
 class configuration_space {
 public:
   configuration_space();
@@ -23,14 +116,139 @@ public:
   double next_event_cond_prob() const;
   event next_event() const;
   bool next_event_ready() const;
-  void predict(unsigned max_events, double predict_time_limit, function<completion_set(const pattern&)> get_first_order_completions);
+  //Expands the best leaf until max_events leaves have been expanded or predict_time_limit seconds have passed,
+  //whichever is first, and returns how many were.  A time limit of zero or less means no limit.
+  //get_first_order_completions is anything that can be called as completion_set(const pattern&); a plain function or
+  //a lambda can be inlined, where a std::function can not.
+  template<class completer> unsigned predict(unsigned max_events, double predict_time_limit, completer get_first_order_completions);
+  //The same, but asks for the completions of up to leaves_per_batch of the best leaves at once, as
+  //get_completions(const pattern* givens, unsigned count, completion_set* completions), which fills in
+  //completions[i] for givens[i].  Leaves whose completions are cached are left out, so count may be less.
+  //The expansion threads are not used; the callee is free to spread the batch over threads of its own.
+  template<class batch_completer> unsigned predict_batched(unsigned max_events, double predict_time_limit, unsigned leaves_per_batch, batch_completer get_completions);
+  //With threads, predict takes the leaves_per_round best leaves at a time (one per thread by default) and gets their
+  //completions concurrently, so get_first_order_completions must be safe to call from several threads at once.
+  //The expansions are applied in order of probability, so the tree comes out the same however the calls interleave.
+  void set_expansion_threads(unsigned num_threads, unsigned leaves_per_round = 0);
+  //By default the whole tree is kept, back to the first event.  With a horizon of zero or more, the space re-roots at
+  //the fulcrum every time an event is chosen: the resolved path above it and every branch off it are freed, and the
+  //events on the path are kept only as givens, and only those at most horizon ticks before the fulcrum, so a horizon
+  //of zero keeps just the events at the fulcrum's own tick.
+  //INT_MAX keeps every given.
+  void set_history_horizon(int horizon);
+  //Keeps the tree to a beam.  A new leaf with less than min_relative_prob of the root's probability is pruned as soon
+  //as it is made, and whenever there are more than max_leaves leaves the lowest are pruned until there are an eighth
+  //fewer.  A pruned leaf is never expanded but keeps its probability, and once both leaves of a pair are pruned they
+  //are freed and their parent becomes a pruned leaf holding the sum, so every probability above stays the same.
+  //Zero for either turns it off; both are off by default.
+  void set_beam(unsigned max_leaves, double min_relative_prob = 0.0);
+  //Remembers up to max_entries completions and asks get_first_order_completions only for givens it has not seen.
+  //Off by default.  Call invalidate_completions() whenever what the callback would return changes, as when the
+  //model behind it trains.
+  void set_completion_cache_size(unsigned max_entries);
+  void invalidate_completions();
   void display_contents();
 private:
-  config_node* root_node;
-  config_node* fulcrum_node;
+  //Operations on the nodes of the tree
+  bool expanded(cn_index n) const;
+  void expand(cn_index n, int t, double given_prob, double complement_prob);
+  void invalidate_prob(cn_index n);
+  void free_subs(cn_index n);
+  const pattern& givens(cn_index n); //good until the next call
+  int givens_origin() const; //the t of the first event of the last givens
+  void pop_givens_path(cn_index keep);
+  double prob(cn_index n) const;
+  double sub_event_cond_prob(cn_index n) const;
+  event sub_event(cn_index n) const;
+  void zero_out(cn_index n);
+  cn_index choose(cn_index n, bool p);
+  void print(cn_index n, unsigned tab_layers = 0);
+  void reroot();
+  bool resolved(cn_index n) const;
+  void prune(cn_index leaf);
+  void trim_frontier();
+  unsigned begin_round(unsigned max_leaves);
+  void end_round();
+  void end_expansion();
+  mutable config_arena nodes; //mutable since probabilities are recalculated lazily
+  leaf_frontier frontier;
+  cn_index root_node;
+  cn_index fulcrum_node;
+  vector<cn_index> release_stack; //scratch for free_subs()
+  mutable vector<cn_index> prob_stack; //scratch for prob()
+  //The givens of the last node asked for.  Asking for a node near it, most often a child, only costs the difference.
+  vector<cn_index> givens_path; //root first
+  vector<event> path_events; //the history, then the events of givens_path, sorted together
+  pattern path_givens; //path_events as a pattern
+  bool givens_dirty; //path_givens is behind path_events
+  vector<cn_index> givens_climb; //scratch for givens()
+  int history_horizon; //negative to keep the whole tree
+  vector<event> history; //events resolved and freed by reroot() which are still givens, sorted
+  unsigned beam_max_leaves; //0 for no limit
+  double beam_min_relative_prob;
+  vector<cn_index> beam_scratch; //for trim_frontier()
+  completion_cache completions;
+  task_pool* expansion_pool; //NULL to expand one leaf at a time
+  unsigned leaves_per_round;
+  //A round of leaves expanded together, from begin_round() to end_round()
+  vector<cn_index> round_leaves;
+  vector<int> round_origins;
+  vector<completion_set> round_completions;
+  vector<unsigned> round_misses; //the leaves whose completions were not cached
+  vector<pattern> round_givens; //the givens of each miss
+  vector<completion_set> round_answers; //to be filled in with the completions of each miss
 };
 
 
 
 
+//Member templates of the configuration space
+template<class completer>
+unsigned configuration_space::predict(unsigned max_events, double predict_time_limit, completer get_first_order_completions) {
+  predict_deadline deadline(predict_time_limit);
+  unsigned expansions = 0;
+  while(expansions < max_events && frontier.size() > 0 && !deadline.passed(expansions)) { //frontier empty if all is pruned
+    if(leaves_per_round > 1) {
+      unsigned num_leaves = begin_round(min(leaves_per_round, max_events - expansions));
+      {
+	task_group group(*expansion_pool);
+	for(unsigned j = 0;j < round_misses.size();j++)
+	  group.run([this, j, &get_first_order_completions]() { round_answers[j] = get_first_order_completions(round_givens[j]); });
+	group.wait();
+      }
+      end_round();
+      expansions += num_leaves;
+    } else {
+      cn_index best_node = frontier.top(); //the leaf with the highest probability, in O(1); expanding it costs O(log N)
+      const pattern& best_givens = givens(best_node);
+      completion_set cmp;
+      if(!completions.find(best_givens, cmp)) {
+	cmp = get_first_order_completions(best_givens);
+	completions.insert(best_givens, cmp);
+      }
+      expand(best_node, givens_origin() + cmp.t_offset, cmp.event_prob, cmp.complement_prob);
+      expansions++;
+    }
+    end_expansion();
+  }
+
+  return expansions;
+}
+
+template<class batch_completer>
+unsigned configuration_space::predict_batched(unsigned max_events, double predict_time_limit, unsigned leaves_per_batch, batch_completer get_completions) {
+  predict_deadline deadline(predict_time_limit);
+  unsigned expansions = 0;
+  while(expansions < max_events && frontier.size() > 0 && !deadline.passed(expansions)) {
+    unsigned num_leaves = begin_round(min(max(leaves_per_batch, 1u), max_events - expansions));
+    if(!round_misses.empty())
+      get_completions(&round_givens[0], round_misses.size(), &round_answers[0]);
+    end_round();
+    expansions += num_leaves;
+    end_expansion();
+  }
+
+  return expansions;
+}
+
 #endif
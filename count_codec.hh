@@ -0,0 +1,102 @@
+/*****
+      count_codec.hh
+      Compact encodings for counts and probabilities stored in large numbers of nodes
+******/
+
+#include <cmath>
+#include <climits>
+#include <limits>
+using namespace std;
+
+#ifndef COUNT_CODEC
+#define COUNT_CODEC
+
+/*
+  A codec says how a number is stored: a storage type, and encode() and decode() between it and a double.
+  quantized<codec> holds one stored number and behaves like a double, so a field can change codec without the code
+  that reads and writes it changing.  Every value is decoded on read and encoded on write, and anything between
+  encodings is rounded to the nearest one.  So a log codec is only good for numbers which are written a few times and
+  read many times.  Adding 1 to a large count over and over would round away every increment.
+*/
+template<class codec> class quantized {
+public:
+  quantized() : stored(codec::encode(0.0)) {}
+  quantized(double value) : stored(codec::encode(value)) {}
+  operator double() const { return codec::decode(stored); }
+  quantized& operator=(double value) { stored = codec::encode(value); return *this; }
+  quantized& operator+=(double value) { stored = codec::encode(codec::decode(stored) + value); return *this; }
+  quantized& operator-=(double value) { stored = codec::encode(codec::decode(stored) - value); return *this; }
+private:
+  typename codec::storage stored;
+};
+
+//No compression at all
+class exact_codec {
+public:
+  typedef double storage;
+  static storage encode(double value) { return value; }
+  static double decode(storage stored) { return stored; }
+};
+
+//Fixed point in a signed 16 bit integer.  Every count shares the scale 1/2^frac_bits, so with the default of 2 a count
+//is exact to the nearest quarter, and saturates at +/-8191.75.
+template<unsigned frac_bits = 2> class fixed16_codec {
+public:
+  typedef short storage;
+  static storage encode(double value) {
+    double scaled = value*(1 << frac_bits);
+    if(scaled >= SHRT_MAX)
+      return SHRT_MAX;
+    if(scaled <= -SHRT_MAX)
+      return -SHRT_MAX;
+    return storage(lround(scaled));
+  }
+  static double decode(storage stored) { return double(stored)/(1 << frac_bits); }
+};
+
+//Stores sign(c)*log2(1 + |c|) in steps of 1/steps_per_octave, so the relative error is about the same for every
+//magnitude of count: 0.07% for log16_codec, 9% for log8_codec.  Zero and small integers come back exactly or nearly so.
+template<class storage_t, unsigned steps_per_octave> class log_codec {
+public:
+  typedef storage_t storage;
+  static storage encode(double value) {
+    double level = log2(1.0 + fabs(value))*steps_per_octave;
+    double max_level = numeric_limits<storage_t>::max();
+    if(level > max_level)
+      level = max_level;
+    storage_t stored = storage_t(lround(level));
+    return (value < 0.0 ? -stored : stored);
+  }
+  static double decode(storage stored) {
+    double magnitude = exp2(double(stored < 0 ? -stored : stored)/steps_per_octave) - 1.0;
+    return (stored < 0 ? -magnitude : magnitude);
+  }
+};
+
+typedef log_codec<short, 1024> log16_codec; //counts up to about 4e9
+typedef log_codec<signed char, 8> log8_codec; //counts up to about 6e4
+
+//Probabilities in [0, 1] as -log2(p) in steps of 1/2048 in 16 bits: relative error under 0.02% down to p = 2^-31.99,
+//with zero kept exact.  The top code stands for zero, so smaller probabilities are stored as 2^-31.99, and values
+//above 1 are stored as 1.
+class log_prob16_codec {
+public:
+  typedef unsigned short storage;
+  static storage encode(double value) {
+    if(value <= 0.0)
+      return USHRT_MAX;
+    double level = -log2(value)*2048.0;
+    if(level < 0.0)
+      return 0;
+    if(level >= USHRT_MAX - 1)
+      return USHRT_MAX - 1;
+    return storage(lround(level));
+  }
+  static double decode(storage stored) {
+    if(stored == USHRT_MAX)
+      return 0.0;
+    return exp2(-double(stored)/2048.0);
+  }
+};
+
+#endif
@@ -0,0 +1,57 @@
+/*****
+      epoch.cc
+      Epoch based reclamation for objects shared between one writer thread and any number of lock-free readers
+******/
+
+#include "epoch.hh"
+
+epoch_reclaimer::epoch_reclaimer(unsigned max_readers) : global_epoch(1), reader_epochs(max_readers) {
+  for(auto& e : reader_epochs)
+    e.store(0);
+}
+
+//By the time the reclaimer is destroyed there must not be any readers left, so everything can go.
+epoch_reclaimer::~epoch_reclaimer() {
+  for(auto& r : retired)
+    r.free_fn();
+}
+
+unsigned epoch_reclaimer::enter() {
+  while(true) {
+    for(unsigned slot = 0;slot < reader_epochs.size();slot++) {
+      unsigned long long expected = 0;
+      if(reader_epochs[slot].load() == 0 && reader_epochs[slot].compare_exchange_strong(expected, global_epoch.load()))
+	return slot;
+    }
+    //Every slot is taken.  This only happens with more concurrent readers than max_readers; wait for one to leave.
+  }
+}
+
+void epoch_reclaimer::leave(unsigned slot) {
+  reader_epochs[slot].store(0);
+}
+
+void epoch_reclaimer::retire(function<void()> free_fn) {
+  retired_object r;
+  r.epoch = global_epoch.fetch_add(1);
+  r.free_fn = free_fn;
+  retired.push_back(r);
+}
+
+void epoch_reclaimer::reclaim() {
+  unsigned long long oldest_reader = global_epoch.load();
+  for(auto& e : reader_epochs) {
+    unsigned long long reader = e.load();
+    if(reader != 0 && reader < oldest_reader)
+      oldest_reader = reader;
+  }
+
+  auto p_r = retired.begin();
+  while(p_r != retired.end()) {
+    if(p_r->epoch < oldest_reader) {
+      p_r->free_fn();
+      p_r = retired.erase(p_r);
+    } else
+      p_r++;
+  }
+}
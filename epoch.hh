@@ -0,0 +1,45 @@
+/*****
+      epoch.hh
+      Epoch based reclamation for objects shared between one writer thread and any number of lock-free readers
+******/
+
+#include <atomic>
+#include <vector>
+#include <list>
+#include <functional>
+#include <iostream>
+using namespace std;
+
+#ifndef EPOCH
+#define EPOCH
+
+/*
+  The writer publishes a new version of some object with an atomic pointer swap and hands the old version to retire().
+  It cannot free the old version right away, because a reader may have loaded the old pointer just before the swap.
+  So every reader announces the global epoch in a slot of its own before it loads the pointer, and clears the slot when
+  it is done.  Each retired object is stamped with the epoch it was retired in, and the global epoch is then advanced.
+  A retired object can be freed once no reader slot holds an epoch at or before its stamp: any reader that announced
+  later loaded the pointer after the swap, so it cannot be holding the old version.
+  Readers never block and never allocate.  Only the writer thread may call retire() and reclaim().
+*/
+class epoch_reclaimer {
+public:
+  epoch_reclaimer(unsigned max_readers = 64);
+  ~epoch_reclaimer();
+  unsigned enter(); //returns the reader slot to pass to leave()
+  void leave(unsigned slot);
+  void retire(function<void()> free_fn);
+  void reclaim();
+  unsigned num_retired() const { return retired.size(); }
+private:
+  class retired_object {
+  public:
+    unsigned long long epoch;
+    function<void()> free_fn;
+  };
+  atomic<unsigned long long> global_epoch;
+  vector< atomic<unsigned long long> > reader_epochs; //zero means the slot is free
+  list<retired_object> retired;
+};
+
+#endif
@@ -0,0 +1,107 @@
+/*****
+      heuristic.cc
+      Scratch space for adding up completion heuristics tick by tick
+******/
+
+#include "heuristic.hh"
+#include <algorithm>
+
+heuristic_accumulator::heuristic_accumulator() {
+  base = 0;
+}
+
+//The dense window starts a quarter of the way back, since patterns reach both ways from the givens.
+void heuristic_accumulator::clear(int window_start) {
+  if(weights.empty()) {
+    weights.assign(HEURISTIC_DENSE_TICKS, 0.0);
+    tick_events.resize(HEURISTIC_DENSE_TICKS);
+    is_touched.assign(HEURISTIC_DENSE_TICKS, false);
+  }
+
+  for(unsigned i : touched) {
+    if(i < unsigned(HEURISTIC_DENSE_TICKS)) {
+      weights[i] = 0.0;
+      tick_events[i].clear(); //keeps its capacity for next time
+      is_touched[i] = false;
+    }
+  }
+  touched.clear();
+  weights.resize(HEURISTIC_DENSE_TICKS);
+  tick_events.resize(HEURISTIC_DENSE_TICKS);
+  far_slots.clear();
+  far_ticks.clear();
+  base = window_start - HEURISTIC_DENSE_TICKS/4;
+}
+
+int heuristic_accumulator::find_slot(int t) const {
+  long long i = (long long)t - base;
+  if(i >= 0 && i < HEURISTIC_DENSE_TICKS)
+    return i;
+
+  auto p_far = far_slots.find(t);
+  if(p_far == far_slots.end())
+    return -1;
+  return p_far->second;
+}
+
+unsigned heuristic_accumulator::slot(int t) {
+  long long i = (long long)t - base;
+  if(i >= 0 && i < HEURISTIC_DENSE_TICKS) {
+    if(!is_touched[i]) {
+      is_touched[i] = true;
+      touched.push_back(i);
+    }
+    return i;
+  }
+
+  auto p_far = far_slots.find(t);
+  if(p_far != far_slots.end())
+    return p_far->second;
+
+  unsigned far = weights.size();
+  weights.push_back(0.0);
+  tick_events.push_back(vector<event>());
+  far_slots[t] = far;
+  far_ticks.push_back(t);
+  touched.push_back(far);
+  return far;
+}
+
+int heuristic_accumulator::tick(unsigned i) const {
+  if(i < unsigned(HEURISTIC_DENSE_TICKS))
+    return base + int(i);
+  return far_ticks[i - HEURISTIC_DENSE_TICKS];
+}
+
+void heuristic_accumulator::add(const event& e, double weight) {
+  unsigned i = slot(e.t);
+  weights[i] += weight;
+  tick_events[i].push_back(e);
+}
+
+double heuristic_accumulator::weight(int t) const {
+  int i = find_slot(t);
+  return (i < 0 ? 0.0 : weights[i]);
+}
+
+const vector<event>& heuristic_accumulator::events(int t) const {
+  static const vector<event> none;
+  int i = find_slot(t);
+  return (i < 0 ? none : tick_events[i]);
+}
+
+void heuristic_accumulator::top_ticks(unsigned k, vector<int> &ticks) const {
+  vector<unsigned> candidates;
+  for(unsigned i : touched) {
+    if(weights[i] > 0.0)
+      candidates.push_back(i);
+  }
+
+  auto heavier = [this](unsigned i1, unsigned i2) { return weights[i1] > weights[i2] || (weights[i1] == weights[i2] && tick(i1) < tick(i2)); };
+  k = min(k, unsigned(candidates.size()));
+  partial_sort(candidates.begin(), candidates.begin() + k, candidates.end(), heavier);
+
+  ticks.clear();
+  for(unsigned j = 0;j < k;j++)
+    ticks.push_back(tick(candidates[j]));
+}
@@ -0,0 +1,45 @@
+/*****
+      heuristic.hh
+      Scratch space for adding up completion heuristics tick by tick
+******/
+
+#include "pattern.hh"
+#include <vector>
+#include <unordered_map>
+using namespace std;
+
+#ifndef HEURISTIC
+#define HEURISTIC
+
+/*
+  Adds up a weight and gathers events for each tick a completion request touches.
+  Ticks near the occurrence being completed index a dense array directly.  The few that land further out (a big
+  pattern like the training set reaches far back) get slots after the dense ones, found through a hash table.
+  clear() only resets the slots that were touched, and nothing is freed, so once an accumulator has been used a few
+  times a request allocates nothing.  Keep one per thread.
+*/
+const int HEURISTIC_DENSE_TICKS = 4096;
+
+class heuristic_accumulator {
+public:
+  heuristic_accumulator();
+  void clear(int window_start); //window_start is the first tick of the occurrence about to be completed
+  void add(const event& e, double weight);
+  double weight(int t) const;
+  const vector<event>& events(int t) const; //empty if t was not touched
+  void top_ticks(unsigned k, vector<int> &ticks) const; //the k heaviest ticks with positive weight, heaviest first; ties go to the earlier tick
+  unsigned num_touched() const { return touched.size(); }
+private:
+  int find_slot(int t) const; //-1 if t has no slot
+  unsigned slot(int t); //makes one if need be
+  int tick(unsigned i) const;
+  int base; //tick of slot 0
+  vector<double> weights;
+  vector< vector<event> > tick_events;
+  vector<char> is_touched; //dense slots only; far slots are always touched
+  vector<unsigned> touched; //dense slots touched since the last clear(), then the far slots
+  unordered_map<int, unsigned> far_slots;
+  vector<int> far_ticks; //tick of far slot HEURISTIC_DENSE_TICKS + i
+};
+
+#endif
@@ -0,0 +1,143 @@
+/*****
+      log_prob.cc
+      Probabilities as fixed point base 2 logarithms, so long products neither underflow nor pay for a divide
+******/
+
+#include "log_prob.hh"
+
+static const double LOG_PROB_SCALE = double(1ll << LOG_PROB_FRAC_BITS);
+static const int LOG_ADD_STEP_BITS = 6; //log2(LOG_ADD_STEPS_PER_OCTAVE)
+static const int LOG_ADD_FRAC_SHIFT = LOG_PROB_FRAC_BITS - LOG_ADD_STEP_BITS;
+
+//log2(1 + 2^-d) and log2(1 - 2^-d), in the fixed point format, at every step of d.
+//The second blows up as d goes to 0, so below one octave log_sub() works it out directly instead.
+static long long log_add_table[LOG_ADD_TABLE_SIZE];
+static long long log_sub_table[LOG_ADD_TABLE_SIZE];
+
+static bool build_tables() {
+  for(int i = 0;i < LOG_ADD_TABLE_SIZE;i++) {
+    double d = double(i)/LOG_ADD_STEPS_PER_OCTAVE;
+    log_add_table[i] = llround(log2(1.0 + exp2(-d))*LOG_PROB_SCALE);
+    log_sub_table[i] = (i < LOG_ADD_STEPS_PER_OCTAVE ? 0 : llround(log2(1.0 - exp2(-d))*LOG_PROB_SCALE));
+  }
+  return true;
+}
+static bool tables_built = build_tables();
+
+//Linear interpolation between the two table entries on either side of d
+static long long interpolate(const long long* table, long long d) {
+  long long i = d >> LOG_ADD_FRAC_SHIFT;
+  long long frac = d & ((1ll << LOG_ADD_FRAC_SHIFT) - 1);
+  return table[i] + (((table[i + 1] - table[i])*frac) >> LOG_ADD_FRAC_SHIFT);
+}
+
+log_prob log_prob::saturate(long long raw) {
+  log_prob result;
+  if(raw <= LOG_PROB_ZERO_RAW)
+    result.raw = LOG_PROB_ZERO_RAW;
+  else if(raw >= LOG_PROB_MAX_RAW)
+    result.raw = LOG_PROB_MAX_RAW;
+  else
+    result.raw = raw;
+  return result;
+}
+
+log_prob log_prob::from_double(double p) {
+  if(p <= 0.0)
+    return log_prob();
+  return from_log2(log2(p));
+}
+
+log_prob log_prob::from_log2(double l) {
+  if(l*LOG_PROB_SCALE <= double(LOG_PROB_ZERO_RAW))
+    return log_prob();
+  if(l*LOG_PROB_SCALE >= double(LOG_PROB_MAX_RAW))
+    return saturate(LOG_PROB_MAX_RAW);
+  return saturate(llround(l*LOG_PROB_SCALE));
+}
+
+double log_prob::to_double() const {
+  if(is_zero())
+    return 0.0;
+  return exp2(to_log2());
+}
+
+double log_prob::to_log2() const {
+  if(is_zero())
+    return -INFINITY;
+  return double(raw)/LOG_PROB_SCALE;
+}
+
+log_prob log_prob::operator*(const log_prob& other) const {
+  if(is_zero() || other.is_zero())
+    return log_prob();
+  return saturate(raw + other.raw);
+}
+
+log_prob log_prob::operator/(const log_prob& other) const {
+  if(is_zero())
+    return log_prob();
+  if(other.is_zero())
+    return saturate(LOG_PROB_MAX_RAW);
+  return saturate(raw - other.raw);
+}
+
+bool operator==(const log_prob& p1, const log_prob& p2) {
+  return p1.raw == p2.raw;
+}
+
+bool operator<(const log_prob& p1, const log_prob& p2) {
+  return p1.raw < p2.raw;
+}
+
+log_prob log_add(const log_prob& p1, const log_prob& p2) {
+  const log_prob& big = (p2 < p1 ? p1 : p2);
+  const log_prob& small = (p2 < p1 ? p2 : p1);
+  if(small.is_zero())
+    return big;
+
+  long long d = big.raw - small.raw;
+  if(d >= (long long)LOG_ADD_TABLE_OCTAVES << LOG_PROB_FRAC_BITS)
+    return big;
+
+  log_prob result;
+  result.raw = big.raw + interpolate(log_add_table, d);
+  return result;
+}
+
+log_prob log_sub(const log_prob& p1, const log_prob& p2) {
+  if(p2.is_zero())
+    return p1;
+  if(!(p2 < p1))
+    return log_prob();
+
+  long long d = p1.raw - p2.raw;
+  if(d >= (long long)LOG_ADD_TABLE_OCTAVES << LOG_PROB_FRAC_BITS)
+    return p1;
+
+  log_prob result;
+  if(d < 1ll << LOG_PROB_FRAC_BITS)
+    result.raw = p1.raw + llround(log2(1.0 - exp2(-double(d)/LOG_PROB_SCALE))*LOG_PROB_SCALE); //the table is no good this close
+  else
+    result.raw = p1.raw + interpolate(log_sub_table, d);
+  if(result.raw <= LOG_PROB_ZERO_RAW)
+    return log_prob();
+  return result;
+}
+
+//Member functions of the sum
+void log_sum::add(const log_prob& p, bool negative) {
+  if(negative)
+    this->negative = log_add(this->negative, p);
+  else
+    positive = log_add(positive, p);
+}
+
+void log_sum::add(const log_sum& other) {
+  positive = log_add(positive, other.positive);
+  negative = log_add(negative, other.negative);
+}
+
+log_prob log_sum::total() const {
+  return log_sub(positive, negative);
+}
@@ -0,0 +1,65 @@
+/*****
+      log_prob.hh
+      Probabilities as fixed point base 2 logarithms, so long products neither underflow nor pay for a divide
+******/
+
+#include <cmath>
+#include <climits>
+using namespace std;
+
+#ifndef LOG_PROB
+#define LOG_PROB
+
+/*
+  A log_prob holds log2(p) in fixed point, with LOG_PROB_FRAC_BITS bits after the point in a 64 bit integer.
+  Multiplying and dividing probabilities is adding and subtracting integers, and the range runs down to p = 2^-(2^30),
+  so the product of thousands of small probabilities is still exact to the last bit of the format.
+  Adding probabilities uses log2(2^a + 2^b) = a + log2(1 + 2^(b - a)) for a >= b, with the correction term
+  interpolated from a table; it vanishes once a and b are LOG_ADD_TABLE_OCTAVES apart.  Relative error of a sum is
+  around 1e-6.
+  p = 0 is a value of its own.  It absorbs products, and dividing by it saturates instead of overflowing.
+  Negative numbers cannot be represented; log_sum keeps the negative terms of a sum apart.
+*/
+const int LOG_PROB_FRAC_BITS = 32;
+const long long LOG_PROB_ONE_RAW = 0;
+const long long LOG_PROB_ZERO_RAW = LLONG_MIN/4; //far enough from LLONG_MIN that one add or subtract cannot wrap
+const long long LOG_PROB_MAX_RAW = LLONG_MAX/4;
+const int LOG_ADD_TABLE_OCTAVES = 32;
+const int LOG_ADD_STEPS_PER_OCTAVE = 64;
+const int LOG_ADD_TABLE_SIZE = LOG_ADD_TABLE_OCTAVES*LOG_ADD_STEPS_PER_OCTAVE + 1; //2049 entries: 64 per octave, and the end point
+
+class log_prob {
+public:
+  log_prob() { raw = LOG_PROB_ZERO_RAW; }
+  static log_prob from_double(double p);
+  static log_prob from_log2(double l);
+  static log_prob one() { log_prob result; result.raw = LOG_PROB_ONE_RAW; return result; }
+  double to_double() const;
+  double to_log2() const;
+  bool is_zero() const { return raw <= LOG_PROB_ZERO_RAW; }
+  log_prob operator*(const log_prob& other) const;
+  log_prob operator/(const log_prob& other) const;
+  log_prob& operator*=(const log_prob& other) { return (*this = *this*other); }
+  log_prob& operator/=(const log_prob& other) { return (*this = *this/other); }
+  long long raw;
+private:
+  static log_prob saturate(long long raw);
+};
+
+bool operator==(const log_prob& p1, const log_prob& p2);
+bool operator<(const log_prob& p1, const log_prob& p2);
+log_prob log_add(const log_prob& p1, const log_prob& p2);
+log_prob log_sub(const log_prob& p1, const log_prob& p2); //p1 - p2, or zero if p2 >= p1
+
+//A sum of probabilities, some of which may be negative.  Negative counts make for negative local probabilities.
+class log_sum {
+public:
+  void add(const log_prob& p, bool negative = false);
+  void add(const log_sum& other);
+  log_prob total() const; //zero if the negative terms outweigh the positive ones
+private:
+  log_prob positive;
+  log_prob negative;
+};
+
+#endif
@@ -19,141 +19,55 @@ FIXME: are sub links *really* necessary??
 
 */
 
-//Model node and associated functions
-class model_node;
-class mn_link {
-public:
-  mn_link(model_node* p_node, int t_offset) { this->p_node = p_node; this->t_offset = t_offset; }
-  model_node* p_node;
-  int t_offset;
-};
-
-class model_node {
-public:
-  model_node();
-  void get_super_links(const occurrence& target_occ, list<mn_link> &supers);
-  void get_sub_links(model_node* p_search_node, list< sub_link > &sub_links, int t_abs, unsigned visit_id);
-  void reset_super_link(model_node* link_node, int t_offset);
-  void remove_super_links(model_node* link_node);
-  void free_subtree();
-  pattern patt;
-  double count;
-private:
-  bool is_compatible(const occurrence& occ, int t_abs) const;
-  bool already_visited(unsigned visit_id, int t_abs) const;
-  void mark_visited(unsigned visit_id, int t_abs);
-  unsigned last_visit_id;
-  list<unsigned> visited_t_abs; //for this visit id.  We only want to visit each pattern one time with a particular t_abs.
-  list<patt_link> super_links;
-  unsigned ref_count;
-};
-
-void model_node::model_node() {
-  count = 0.0;
-  last_visit_id = UINT_MAX;
-  ref_count = 0;
+//Walking the DAG
+//The root pattern is special: it is empty, and it contains a super for the givens at every possible t.  So instead of using
+//the offsets of its links we match every super against every event of the target occurrence.
+template<class F> static void for_each_super(const model_node_arena& nodes, mn_index n, const occurrence& target_occ, F f) {
+  if(nodes[n].patt.p.empty()) {
+    for(auto p_e = target_occ.cbegin();p_e != target_occ.cend();p_e++)
+      nodes.for_each_super_link(n, [&](const mn_link& l) { f(mn_link(l.node, p_e->t)); });
+  } else
+    nodes.for_each_super_link(n, f);
 }
 
 //FIXME: for all below functions, pattern& has been replaced by model_node&
 //Returns true if the pattern and the occurrence are not mutually exclusive
-bool model_node::is_compatible(const occurrence& occ, int t_abs) const {
-  return is_single_valued(get_union(occ, get_occurrence(patt, t_abs)));
-}
-
-bool model_node::already_visited(unsigned visit_id, int t_abs) const {
-  return (last_visit_id == visit_id && find(visited_t_abs.begin(), visited_t_abs.end(), t_abs) != visited_t_abs.end());
-}
-
-void model_node::mark_visited(unsigned visit_id, int t_abs) {
-  if(last_visit_id != visit_id)
-    visited_t_abs.clear();
-
-  last_visit_id = visit_id;
-  visited_t_abs.push_back(t_abs);
+bool model_state::is_compatible(const occurrence& occ, mn_index n, int t_abs) const {
+  return is_match(occ, nodes[n].patt, t_abs);
 }
 
-void model_node::get_super_links(const occurrence& target_occ, list<mn_link> &supers) {
-  if(patt.p.empty()) { //base case pattern, contains a super for the givens at every possible t
-    supers.clear();
-    for(auto p_e = target_occ.cbegin();p_e != target_occ.cend();p_e++) {
-      for(auto p_link = super_links.cbegin(); p_link != super_links.cend();p_link++) {
-	supers.push_back(mn_link(p_link->p_node, p_e->t));
-      }
-    }
-  } else {
-    supers = super_links;
-  }
+//The same for a pattern that has no node
+bool model_state::is_match(const occurrence& occ, const pattern& p, int t_abs) const {
+  return is_single_valued(get_union(occ, get_occurrence(p, t_abs)));
 }
 
-//C++ always has so much boilerplate.  A little helper class.
-class sub_link {
-public:
-  sub_link(model_node* p_sub_node, list<mn_link>::iterator p_sub_link) { this.p_sub_node = p_sub_node; this.p_super_link = p_super_link; }
-  model_node* p_sub_node;
-  list<mn_link>::iterator p_super_link; //super of this sub
-};
-  
-void model_node::get_sub_links(model_node* p_search_node, list< sub_link > &sub_links, int t_abs, unsigned visit_id) {
-  occurrence target_occ = get_occurrence(patt, 0);
+void model_state::get_sub_links(mn_index target, mn_index search, list<sub_link> &subs, int t_abs, visit_set &visited) const {
+  occurrence target_occ = get_occurrence(nodes[target].patt, 0);
+  if(search == training_set)
+    return; //it is a sub of nothing but the apex, and matching it at every placement costs a copy of the whole history
   
-  if(p_search_node->already_visited(visit_id, t_abs) || !is_sub_occurrence(target_occ, get_occurrence(p_search_node->patt, t_abs)))
+  if(!visited.insert(search, t_abs) || !is_sub_occurrence(target_occ, get_occurrence(nodes[search].patt, t_abs)))
     return;
   
-  p_search_node->mark_visited(visit_id, t_abs);
-  
-  list<mn_link> search_supers;
-  get_super_links(target_occ, search_supers);
+  vector<mn_link> search_supers;
+  for_each_super(nodes, search, target_occ, [&](const mn_link& l) { search_supers.push_back(l); });
   for(auto p_link = search_supers.begin();p_link != search_supers.end();p_link++) {
-    if(p_link->p_node == this)
-      subs.push_back(sub_link(p_search_node, p_link));
+    if(p_link->node == target)
+      subs.push_back(sub_link(search, *p_link));
     else
-      get_sub_links(p_link->p_node, subs, t_abs + p_link->t_offset, visit_id);
+      get_sub_links(target, p_link->node, subs, t_abs + p_link->t_offset, visited);
   }
 }
 
-void model_node::reset_super_link(model_node* link_node, int t_offset) {
-  for(auto p_link = super_links.begin();p_link != super_links.end();p_link++) {
-    if(p_link->p_node == link_node && p_link->t_offset == t_offset)
-      return; //already here
-  }
-
-  super_links.push_back(mn_link(link_node, t_offset));
-  link_node->ref_count++;
-}
-
-void model_node::remove_super_links(model_node* link_node = NULL) {
-  auto p_link = super_links.begin();
-  while(p_link != super_links.end()) {
-    if(link_node == NULL || p_link->p_node == link_node) {
-      p_link = erase(p_link);
-      link_node->ref_count--;
-    } else
-      p_link++;
-  }
-}
-
-list<mn_link>::iterator p_link model_node::remove_super_link(list<mn_link>::iterator p_link) {
-  p_link->p_node->ref_count--;
-  return erase(p_link);
-}
-
-void model_node::free_subtree() {
-  ref_count--;
-  if(ref_count == 0) {
-    for(auto p_sup = super_links.begin();p_sup != super_links.end();p_current++)
-      p_sup->p_node->free_subtree();
-
-    delete this;
-  }
-}
-
-//Member functions for the model class
-model::model(unsigned memory_constraint) {
-  this->memory_constraint = memory_constraint;
+//Member functions for the model state
+model_state::model_state() {
+  version = 0;
   total_num_events = 0.0;
 
   PRIOR_EVENT_DENSITY = 1.0;
   PRIOR_INTERVAL = 1.0;
+  pool = NULL;
+  fan_out_threshold = 8;
 
   /*
     The tree is initialized like this:
@@ -202,32 +116,142 @@ model::model(unsigned memory_constraint) {
                      root
 		     
     In this scenario note that patt_1 is abstracted from the training set and not set in absolute time.  So
-    it is not reachable from the apex, but only from the root.  That is why we clear the tree from the
-    bottom up.
+    it is not reachable from the apex, but only from the root.
+
+    All of the nodes live in the arena and are referred to by index, so tearing the model down is just a
+    matter of letting the arena go.
   */
   
-  apex = new node();
-  training_set = new node();
-  base_case_0 = new node();
-  base_case_1 = new node();
-  root = new node();
+  apex = nodes.create();
+  training_set = nodes.create();
+  base_case_0 = nodes.create();
+  base_case_1 = nodes.create();
+  root = nodes.create();
 
-  base_case_0->patt.p.push_back(0);
-  base_case_1->patt.p.push_back(1);
+  nodes.set_pattern(base_case_0, pattern(false));
+  nodes.set_pattern(base_case_1, pattern(true));
 
-  training_set->reset_super_link(apex, 0);
-  root->reset_super_link(base_case_0, 0);
-  root->reset_super_link(base_case_1, 0);
+  nodes.add_super_link(training_set, mn_link(apex, 0));
+  nodes.add_super_link(root, mn_link(base_case_0, 0));
+  nodes.add_super_link(root, mn_link(base_case_1, 0));
 
-  training_set->count = 1.0;
+  nodes[training_set].count = 1.0;
 }
 
-void model::~model() {
-  root->free_subtree();
+/*
+  Writes this state out as a snapshot (the format is described in snapshot.hh).  Overlay links go into the CSR arrays
+  and tombstones are left out, so a loaded snapshot starts out compacted.
+*/
+bool model_state::save(const string& filename) const {
+  snapshot_contents contents;
+  contents.header.model_version = version;
+  contents.header.apex = apex;
+  contents.header.training_set = training_set;
+  contents.header.base_case_0 = base_case_0;
+  contents.header.base_case_1 = base_case_1;
+  contents.header.root = root;
+  contents.header.total_num_events = total_num_events;
+
+  contents.nodes.resize(nodes.size());
+  contents.link_begin.reserve(nodes.size() + 1);
+  for(mn_index n = 0;n < nodes.size();n++) {
+    const pattern& patt = nodes[n].patt;
+    snapshot_node& record = contents.nodes[n];
+    record.count = nodes[n].count;
+    record.patt_begin = contents.pattern_p.size();
+    record.patt_size = patt.p.size();
+    record.last_trained = nodes[n].last_trained;
+    record.in_use = nodes[n].in_use;
+    for(unsigned i = 0;i < patt.p.size();i++) {
+      contents.pattern_p.push_back(patt.p[i]);
+      contents.pattern_dt.push_back(i == 0 ? 0 : patt.dt[i - 1]); //the first event has no dt; a zero keeps the two pools lined up
+    }
+
+    contents.link_begin.push_back(contents.links.size());
+    nodes.for_each_super_link(n, [&](const mn_link& l) { contents.links.push_back(l); });
+  }
+  contents.link_begin.push_back(contents.links.size());
+
+  return write_snapshot(filename, contents);
+}
+
+/*
+  Replaces this state with a saved snapshot.  The file is mapped, and the link arrays are read from the mapping in
+  place until something first writes to them.  The node table and the patterns are decoded into the arena, because
+  patterns keep their events in vectors of their own.  Nothing changes unless the whole snapshot checks out.
+*/
+bool model_state::load(const string& filename) {
+  shared_ptr<mapped_snapshot> snapshot(new mapped_snapshot());
+  if(!snapshot->open(filename))
+    return false;
+
+  const snapshot_header& h = snapshot->header();
+  const snapshot_node* records = snapshot->nodes();
+  const unsigned char* pattern_p = snapshot->pattern_p();
+  const unsigned* pattern_dt = snapshot->pattern_dt();
+  const unsigned* link_begin = snapshot->link_begin();
+  const mn_link* links = snapshot->links();
+
+  bool corrupt = (h.apex >= h.num_nodes || h.training_set >= h.num_nodes || h.base_case_0 >= h.num_nodes
+		  || h.base_case_1 >= h.num_nodes || h.root >= h.num_nodes);
+  for(unsigned n = 0;n < h.num_nodes && !corrupt;n++)
+    corrupt = (link_begin[n] > link_begin[n + 1] || records[n].patt_begin > h.num_pattern_events
+	       || records[n].patt_size > h.num_pattern_events - records[n].patt_begin);
+  for(unsigned i = 0;i < h.num_links && !corrupt;i++)
+    corrupt = (links[i].node >= h.num_nodes);
+  if(corrupt) {
+    cout << "ERROR: the snapshot " << filename << " refers to nodes or events it does not have.\n";
+    return false;
+  }
+
+  vector<model_node> restored(h.num_nodes);
+  for(mn_index n = 0;n < h.num_nodes;n++) {
+    const snapshot_node& record = records[n];
+    restored[n].count = record.count;
+    restored[n].last_trained = record.last_trained;
+    restored[n].in_use = (record.in_use != 0);
+    restored[n].patt.p.reserve(record.patt_size);
+    if(record.patt_size > 0)
+      restored[n].patt.dt.reserve(record.patt_size - 1);
+    for(unsigned i = record.patt_begin;i < record.patt_begin + record.patt_size;i++)
+      restored[n].patt.append(pattern_p[i] != 0, pattern_dt[i]);
+  }
+
+  nodes.restore(restored, link_begin, links, snapshot);
+  apex = h.apex;
+  training_set = h.training_set;
+  base_case_0 = h.base_case_0;
+  base_case_1 = h.base_case_1;
+  root = h.root;
+  total_num_events = h.total_num_events;
+  version = h.model_version;
+  return true;
+}
+
+//Member functions for the model class
+model::model(unsigned memory_constraint) : published(NULL), query_cache(0), candidates(1, 1), query_pool(NULL) {
+  this->memory_constraint = memory_constraint;
+  policy = EVICT_BY_INFORMATION;
+  training_clock = 0;
+  max_pattern_width = 64;
+  training_events_start = INT_MIN;
+
+  promotion_threshold = 1;
+  publish_interval = DEFAULT_PUBLISH_INTERVAL;
+  events_since_publish = 0;
+
+  publish();
 }
 
-bool model::ok_to_delink(model_node* n) {
-  if(n == base_case_0 || n == base_case_1 || n == apex || n == root)
+//Any reader still holding a snapshot at this point is a bug in the caller.
+model::~model() {
+  readers.reclaim();
+  delete published.load();
+  delete query_pool;
+}
+
+bool model::ok_to_delink(mn_index n) {
+  if(n == working.base_case_0 || n == working.base_case_1 || n == working.apex || n == working.root || n == working.training_set)
     return false; //This is a bad idea
 
   return true;
@@ -238,43 +262,175 @@ void model::relink_common_subsections(const occurrence& occ1, const occurrence&
   list<pattern> new_patts;
   convolute(occ1, occ2, new_patts);
   for(auto pn = new_patts.begin();pn != new_patts.end();pn++) {
-    relink(root, get_occurrence(*pn, false));
+    relink(get_occurrence(*pn, 0));
+  }
+}
+
+//Returns the events of the training set with t_lb <= t <= t_ub, and sets window_start to the time of the first one.
+//A window reaching back past what training_events still holds is read off the training set pattern instead, which
+//costs a walk over the whole training set; training in order never needs to.
+pattern model::training_window(int t_lb, int t_ub, int& window_start) const {
+  pattern window;
+  window_start = t_lb;
+  int last_t = t_lb;
+  auto add = [&](int t, bool p) {
+    if(window.empty())
+      window_start = t;
+    window.append(p, t - last_t);
+    last_t = t;
+  };
+
+  if(t_lb >= training_events_start) {
+    for(auto p_e = training_events.lower_bound(t_lb);p_e != training_events.end() && p_e->first <= t_ub;p_e++)
+      add(p_e->first, p_e->second);
+  } else {
+    const pattern& training_patt = working.nodes[working.training_set].patt;
+    for(event_ptr p_e = training_patt.begin(training_set_offset());p_e != training_patt.end() && (*p_e).t <= t_ub;++p_e) {
+      if((*p_e).t >= t_lb)
+	add((*p_e).t, (*p_e).p);
+    }
+  }
+  return window;
+}
+
+//The next event trained in order only looks max_pattern_width back from itself, so training_events need not hold
+//anything older than that behind the newest event.
+void model::trim_training_events() {
+  if(training_events.empty())
+    return;
+
+  int keep_from = training_events.rbegin()->first - int(max_pattern_width);
+  if(keep_from <= training_events_start)
+    return;
+  training_events.erase(training_events.begin(), training_events.lower_bound(keep_from));
+  training_events_start = keep_from;
+}
+
+//Records that the events from first to last were trained as one stretch of time, joined to any stretch it touches.
+//The ticks between two stretches may hold events that some other model trained on, which merge() has to look for.
+void model::add_stretch(int first, int last) {
+  auto p_next = stretches.upper_bound(first);
+  if(p_next != stretches.begin()) {
+    auto p_prev = prev(p_next);
+    if(p_prev->second + 1 >= first) {
+      first = p_prev->first;
+      last = max(last, p_prev->second);
+      stretches.erase(p_prev);
+    }
+  }
+  while(p_next != stretches.end() && p_next->first <= last + 1) {
+    last = max(last, p_next->second);
+    p_next = stretches.erase(p_next);
+  }
+  stretches[first] = last;
+}
+
+//A map node holds the pair, three links and the color, which pads out to a fourth.
+static const unsigned long TRAINING_EVENT_BYTES = sizeof(map<int, bool>::value_type) + 4*sizeof(void*);
+
+//Bytes held by the nodes in use and by what is left of training_events.  The tombstones and released slots the arena
+//also holds are left out: a delink leaves both behind, and they are dropped or reused before the arena grows.
+unsigned long model::memory_used() const {
+  return working.nodes.live_memory_used() + training_events.size()*TRAINING_EVENT_BYTES;
+}
+
+//Like relink_common_subsections(window, window), but only for the subsections that contain one of the new events.
+//Every other common subsection of the window was already found when earlier events were trained.
+//A subsection is counted toward promotion once per call, however many alignments sight it.  Counting every alignment
+//instead was tried and promoted too early, since most alignments sight the same pair of occurrences again.
+//relinked holds the subsections the caller has already relinked; relinking one again would only walk the model to
+//find it there, so they are skipped, and the ones relinked here are added.
+void model::relink_new_subsections(const pattern& window, int window_start, const set<int>& new_times,
+				   unordered_set<pattern, pattern_hash> &relinked) {
+  list<pattern> new_patts;
+  list<int> new_offsets;
+  convolute(window, window, new_patts, new_offsets);
+  unordered_set<pattern, pattern_hash> sighted; //the same subsection turns up at several alignments
+  auto p_offset = new_offsets.begin();
+  for(auto pn = new_patts.begin();pn != new_patts.end();pn++, p_offset++) {
+    if(*pn == window || pn->width() > 2*int(max_pattern_width) || sighted.count(*pn))
+      continue; //the window lined up with itself, or a subsection training one event at a time would not have found
+
+    bool has_new_event = false;
+    for(event_ptr p_e = pn->begin(window_start + *p_offset);p_e != pn->end() && !has_new_event;++p_e)
+      has_new_event = (new_times.count((*p_e).t) != 0);
+
+    if(has_new_event) {
+      sighted.insert(*pn);
+      if(promotion_threshold > 1 && candidates.add(*pn) < promotion_threshold)
+	continue; //not seen often enough yet to be worth a node
+      if(!relinked.insert(*pn).second)
+	continue;
+
+      //The walk in relink() does not place the training set, so link the new pattern to it where it was sighted
+      occurrence sighting = get_occurrence(*pn, window_start + *p_offset);
+      mn_index n = relink(sighting);
+      if(n != MN_NULL)
+	working.nodes.add_super_link(n, mn_link(working.training_set, training_set_offset() - sighting[0].t));
+    }
   }
 }
 
+//Hands the count of a node that is about to be delinked down to its immediate subs.
+//The count of a pattern is the count of its occurrences which were not part of any super pattern, so once n is gone
+//those occurrences are occurrences of each of its subs that are not part of a super pattern.  That keeps the sum
+//global_prob() takes over each sub and its supers where it was.
+//FIXME: a pattern that is a sub of two of the immediate subs gets the count twice.  That wants a negative count on
+//the intersection, the way subdivide() would do it.
+void model::distribute_counts(mn_index n, const list<sub_link> &sub_links) {
+  double count = working.nodes[n].count;
+  if(count == 0.0)
+    return;
+
+  for(auto p_sub_link = sub_links.cbegin();p_sub_link != sub_links.cend();p_sub_link++)
+    working.nodes[p_sub_link->sub].count += count;
+
+  working.nodes[n].count = 0.0;
+}
+
 //Delinks the given node from the tree and links the subs of the node to the supers directly.
-//This function can affect statistics, if the count is not zero.
-void model_node::delink(model_node* root) {
+//The count of the node is distributed to its subs first, so statistics for the subs are preserved; statistics for
+//the node itself fall back to the conditional independence estimate.  sub_links is set to the links from the subs
+//that pointed at the node, which are the subs that got its count.
+void model::delink(mn_index n, list<sub_link> &sub_links) {
   //If a node q is a sub of n, and n is a sub of s, then q is a sub of s.
   //So when we delink n, all links from subs of n should be copied and shifted
   //to refer to each of the supers of n.
 
-  //Grab the subs of this node
-  list<sub_link> sub_links;
-  get_sub_links(root, sub_links, 0, m.get_next_visit_id());
+  //Grab the subs and supers of this node
+  sub_links.clear();
+  visit_set visited;
+  working.get_sub_links(n, working.root, sub_links, 0, visited);
+  distribute_counts(n, sub_links);
+  vector<mn_link> super_links;
+  working.nodes.get_super_links(n, super_links);
   
   //For each link in each sub that points back to this node (all the links returned),
   for(auto p_sub_link = sub_links.cbegin();p_sub_link != sub_links.cend();p_sub_link++) {
     //Create a link for each super of n
     for(auto p_super_link = super_links.cbegin();p_super_link != super_links.cend();p_super_link++)
-      p_sub_link->p_node->reset_super_link(p_super_link->p_node, p_super_link->t_offset + p_sub_link->p_super_link->t_offset);
+      working.nodes.add_super_link(p_sub_link->sub, mn_link(p_super_link->node, p_super_link->t_offset + p_sub_link->link.t_offset));
 							  
     //Erase the original link to this node
-    //FIXME: if this becomes a multithreaded app we might have to have some mechanism to lock nodes so p_sub_link->p_super_link remains valid
-    remove_super_link(p_sub_link->p_super_link);
+    working.nodes.remove_super_link(p_sub_link->sub, p_sub_link->link);
   }
 
   //Now erase the links from this node up
-  remove_super_links();
+  working.nodes.remove_super_links(n);
 
-  if(ref_count != 0)
+  if(working.nodes[n].ref_count != 0)
     cout << "ERROR: ref count is not zero after delinking node!\n";
   
-  //Now delete this node
-  delete this;
+  //Now hand the slot back to the arena
+  working.nodes.release(n);
 }
 
 //Performs a no-touch relink (in other words calling this function does not affect returned statistics)
+//Returns the node for occ, or MN_NULL if it was an existing pattern left alone.
+//The walk leaves out the training set, which has a placement for every event ever trained, so the cost does not grow
+//with the length of the history.  The links of the node into the training set are left as they are; the caller links
+//a new pattern to it where it was found.  A query reaches every placement of the training set through the base cases
+//anyway.
 //FIXME: this function and find_context are broken, and I need to rethink them.
 /*
   Try: a separate function to delink and link subs to supers for the removed pattern, and returns the count.
@@ -282,86 +438,91 @@ void model_node::delink(model_node* root) {
   to find the immediate subs and the immediate supers, and then I need to take every link from a listed sub
   to a listed super and link through the new pattern instead, making sure that such links are unique.
  */
-void model::relink(const occurrence& occ, bool only_new = true) {
+mn_index model::relink(const occurrence& occ, bool only_new) {
   list<mn_link> supers;
   list<mn_link> subs;
-  list<model_node*> siblings;
-  model_node* p_node = NULL;
-  find_context(root, occ, supers, subs, siblings, p_node, get_next_visit_id());
-
-  if(p_node == NULL) {
-    p_node = new model_node();
-    p_node->patt = get_pattern(occ);
+  list<mn_index> siblings;
+  mn_index match = MN_NULL;
+  visit_set visited;
+  working.find_context(working.root, occ, supers, subs, siblings, match, 0, visited);
+
+  if(match == MN_NULL) {
+    match = working.nodes.create();
+    working.nodes.set_pattern(match, get_pattern(occ));
   } else if(only_new)
-    return; //This is an existing pattern and we are only relinking new ones
+    return MN_NULL; //This is an existing pattern and we are only relinking new ones
+
+  working.nodes[match].last_trained = training_clock;
 
-  //Remove existing links to and from this node
-  for(auto p_link = p_node->super_links.begin();p_link != p_node->super_links.end();p_link++)
-    reset_super_link(p_link->p_node, p_node);
+  //Remove existing links from this node, but for those into the training set
+  vector<mn_link> old_supers;
+  working.nodes.get_super_links(match, old_supers);
+  for(const mn_link& l : old_supers) {
+    if(l.node != working.training_set)
+      working.nodes.remove_super_link(match, l);
+  }
   
-  //Set the super, sub links  
-  p_node->super_links = supers;
-  p_node->sub_links = subs;
+  //Set the super links
+  for(auto p_link = supers.begin();p_link != supers.end();p_link++)
+    working.nodes.add_super_link(match, *p_link);
 
   //Make sure links in subs, back to this pattern are set correctly
   for(auto p_link = subs.begin();p_link != subs.end();p_link++)
-    remove_super_links(p_link->p_node, p_node, -(p_link->t_offset));
+    working.nodes.add_super_link(p_link->node, mn_link(match, -(p_link->t_offset)));
 
   //Check self and sibling patterns for common subsections
   relink_common_subsections(occ, occ);
   for(auto p_sib = siblings.begin();p_sib != siblings.end();p_sib++)
-    relink_common_subsections(get_occurrence(p_sib->patt, 0), occ);
-}
-
-//p_match is a pointer to the pattern representing occ, unless occ would be a new pattern in which it is NULL.
-typedef enum {SUB, SUPER, SIBLING, IDENTITY, NONE} patt_relation;
-patt_relation model::find_context(model_node& p_current,
-				  const occurrence& target_occ,
-				  list<mn_link> &supers,
-				  list<mn_link> &subs,
-				  list<model_node*> &siblings,
-				  model_node* &p_match,
-				  int t_abs,
-				  unsigned visit_id) {
+    relink_common_subsections(get_occurrence(working.nodes[*p_sib].patt, 0), occ);
+  return match;
+}
+
+//match is the index of the node representing occ, unless occ would be a new pattern in which case it is MN_NULL.
+patt_relation model_state::find_context(mn_index current,
+					const occurrence& target_occ,
+					list<mn_link> &supers,
+					list<mn_link> &subs,
+					list<mn_index> &siblings,
+					mn_index &match,
+					int t_abs,
+					visit_set &visited) const {
   if(target_occ.empty())
     return NONE;
+  if(current == training_set)
+    return NONE; //see model::relink(); matching it costs a copy of the whole history at each of its placements
   
-  if(p_current.already_visited(visit_id, t_abs) || !is_compatible(target_occ, p_current, t_abs))
+  if(!visited.insert(current, t_abs) || !is_compatible(target_occ, current, t_abs))
     return NONE;
-  
-  p_current.mark_visited(visit_id, t_abs);
+  if(current == apex)
+    return NONE; //it only places the training set in time; its empty pattern is not a sub of anything
 
-  occurrence current_occ = get_occurrence(p_current.patt, t_abs);
+  occurrence current_occ = get_occurrence(nodes[current].patt, t_abs);
 
-  //if this pattern is equal to the target, then set the p_match reference and call on the supers
+  //if this pattern is equal to the target, then set the match reference and call on the supers
   if(current_occ == target_occ) {
-    list<mn_link> super_patterns;
-    p_current.get_super_patterns(target_occ, super_patterns);
-    for(auto p_link = super_patterns.begin();p_link != super_patterns.end();p_link++) {
-      find_context(*(p_link->p_node), target_occ, supers, subs, siblings, p_match, t_abs + p_link->t_offset, visit_id);
-    }
+    for_each_super(nodes, current, target_occ, [&](const mn_link& l) {
+	find_context(l.node, target_occ, supers, subs, siblings, match, t_abs + l.t_offset, visited);
+      });
 
-    p_match = &p_current;
+    match = current;
     return IDENTITY;
   }
 
   //if this pattern is a strict super of the target, then add it to the supers list and return
   if(is_sub_occurrence(current_occ, target_occ)) {
-    supers.push_back(mn_link(&p_current, t_abs - target_occ[0].t));
+    supers.push_back(mn_link(current, t_abs - target_occ[0].t));
     return SUPER;
   }
   
   //if this pattern is a sub of the target, then call on the supers and add to the subs list if not the sub of a sub
   if(is_sub_occurrence(target_occ, current_occ)) {
     bool sub_of_a_sub = false;
-    list<mn_link> super_patterns;
-    p_current.get_super_patterns(target_occ, super_patterns);
-    for(auto p_link = super_patterns.begin();p_link != super_patterns.end();p_link++) {
-      if(find_context(*(p_link->p_node), target_occ, supers, subs, siblings, p_match, t_abs + p_link->t_offset, visit_id) == SUB)
-	sub_of_a_sub = true;
-    }
+    for_each_super(nodes, current, target_occ, [&](const mn_link& l) {
+	if(find_context(l.node, target_occ, supers, subs, siblings, match, t_abs + l.t_offset, visited) == SUB)
+	  sub_of_a_sub = true;
+      });
     if(!sub_of_a_sub)
-      subs.push_back(mn_link(&p_current, t_abs - target_occ[0].t));
+      subs.push_back(mn_link(current, t_abs - target_occ[0].t));
     
     return SUB;
   }
@@ -372,139 +533,701 @@ patt_relation model::find_context(model_node& p_current,
     //Each super of a sibling could be: another sibling, or a super of the target, or nothing.
     //If the super is a sup of the target, or a sib of the target, we would not want to add this pattern to the sibling list.
     bool sub_of_a_sib_or_super = false;
-    list<mn_link> super_patterns;
-    p_current.get_super_patterns(target_occ, super_patterns);
-    for(auto p_link = super_patterns.begin();p_link != super_patterns.end();p_link++) {
-      patt_relation sup_relation = find_context(*(p_link->p_node), target_occ, supers, subs, siblings, p_match, t_abs + p_link->t_offset, visit_id);
-      if(sup_relation == SIBLING || sup_relation == SUPER)
-	sub_of_a_sib_or_super = true;
-    }
+    for_each_super(nodes, current, target_occ, [&](const mn_link& l) {
+	patt_relation sup_relation = find_context(l.node, target_occ, supers, subs, siblings, match, t_abs + l.t_offset, visited);
+	if(sup_relation == SIBLING || sup_relation == SUPER)
+	  sub_of_a_sib_or_super = true;
+      });
     
     if(!sub_of_a_sib_or_super)
-      siblings.push_back(&p_current);
+      siblings.push_back(current);
     
     return SIBLING;
   }
+
+  return NONE;
 }
 
-//Severs a link and abstracts away the sub pattern.
-//Removes events unique to the sub from the super.
-//Preserves counts for queries that do not cross the link boundary.
-//This DOES affect returned statistics.
-void model::sever_link(pattern &patt, sub_link_index) {
-  //FIXME finish this
+//How much we would lose by evicting n; the lowest goes first.
+double model::eviction_utility(mn_index n) const {
+  const model_node& node = working.nodes[n];
+  switch(policy) {
+  case EVICT_BY_COUNT:
+    return fabs(node.count);
+  case EVICT_BY_RECENCY:
+    return node.last_trained;
+  case EVICT_BY_INFORMATION:
+  default:
+    //Weight of evidence for the pattern over its events taken independently, times how often we have seen it.
+    double independent_log_prob = 0.0;
+    for(bool p : node.patt.p)
+      independent_log_prob += log2(working.local_prob(p ? working.base_case_1 : working.base_case_0));
+    return fabs(node.count)*(log2(working.local_prob(n)) - independent_log_prob);
+  }
 }
 
 //optimize tree to within memory constraints.
-//FIXME: figure out how to balance between memory spent on the apex pattern vs memory spent on the rest
+//memory_constraint is in bytes and covers what memory_used() does; zero means no limit.  Once we are over, evict the
+//least useful patterns until we are under by a margin, so that the scan is not repeated on every event.
+//Each eviction hands its count to the subs, which changes how useful they are, so those are rated again before the
+//next pick.  A count handed to a base case changes the information of every pattern, so then all of them are.
+//FIXME: figure out how to balance between memory spent on the apex pattern vs memory spent on the rest.  The training
+//set can never be evicted, so if it alone outgrows the constraint there is nothing we can do here.
 void model::optimize(unsigned memory_constraint) {
-  //FIXME finish this
+  if(memory_constraint == 0 || memory_used() <= memory_constraint)
+    return;
+
+  //Lowest utility first.  An entry is stale once its node has been rated again, and is skipped when it comes up.
+  typedef pair<double, mn_index> rated_node;
+  priority_queue< rated_node, vector<rated_node>, greater<rated_node> > candidates;
+  vector<double> utility(working.nodes.size());
+  auto rate = [&](mn_index n) {
+    utility[n] = eviction_utility(n);
+    candidates.push(rated_node(utility[n], n));
+  };
+  auto rate_all = [&]() {
+    candidates = priority_queue< rated_node, vector<rated_node>, greater<rated_node> >();
+    for(mn_index n = 0;n < working.nodes.size();n++) {
+      if(working.nodes[n].in_use && ok_to_delink(n))
+	rate(n);
+    }
+  };
+  rate_all();
+
+  unsigned long target = memory_constraint - memory_constraint/10;
+  list<sub_link> sub_links;
+  while(!candidates.empty() && memory_used() > target) {
+    rated_node next = candidates.top();
+    candidates.pop();
+    if(!working.nodes[next.second].in_use || next.first != utility[next.second])
+      continue;
+
+    delink(next.second, sub_links);
+    bool base_case_changed = false;
+    for(const sub_link& l : sub_links) {
+      if(ok_to_delink(l.sub) && working.nodes[l.sub].in_use)
+	rate(l.sub);
+      else if(l.sub == working.base_case_0 || l.sub == working.base_case_1)
+	base_case_changed = true;
+    }
+    if(base_case_changed && policy == EVICT_BY_INFORMATION)
+      rate_all();
+  }
+
+  working.nodes.compact(); //the delinks leave lots of tombstones behind
+
+  if(memory_used() > memory_constraint)
+    cout << "ERROR: could not fit the model within its memory constraint.\n";
+}
+
+void model::set_eviction_policy(eviction_policy policy) {
+  this->policy = policy;
+}
+
+//Patterns wider than this are never formed from new training data.  Training cost per event grows with the width.
+void model::set_max_pattern_width(unsigned width) {
+  max_pattern_width = width;
+}
+
+/*
+  Most subsections training turns up never recur, but each one still costs a node, its links and a longer walk for
+  every query.  With a threshold above 1 a new subsection is only counted, in a count-min sketch of fixed size, until it
+  has been seen threshold times, and only then becomes a node.  Every sighting is still in the training set, so nothing
+  is lost by promoting late.  Patterns already in the model pass through the sketch too, which does them no harm.
+  The sketch takes sketch_width*4 counters of two bytes each on top of the memory constraint, which does not cover it.
+  Calling this starts the counts over.
+*/
+void model::set_promotion_threshold(unsigned threshold, unsigned sketch_width) {
+  promotion_threshold = max(threshold, 1u);
+  if(promotion_threshold > 1)
+    candidates = count_min_sketch(sketch_width);
+  else
+    candidates = count_min_sketch(1, 1);
 }
 
 //Train the pattern tree given some new data
 //This DOES affect returned statistics.
 void model::train(const event& e) {
-  //Manually insert an event to the end of the training set and link it to a base case pattern
-  int training_set_offset = apex->sub_links[0].t_offset;
-  occurrence training_occ = get_union(get_occurrence(training_set->patt, training_set_offset), get_occurrence(e));
-  training_set->patt = get_pattern(training_occ);
-  model_node* base_case_node;
+  train(vector<event>(1, e));
+}
+
+//Adds one event to the training set, links it to its base case, and makes sure the common subsections of the training
+//set that involve it exist.  No pattern wider than max_pattern_width can overlap the event, so only that window of the
+//training set has to be searched.  Relinking each new pattern links it up to the training set and down to its subs, so
+//the rest of the training set is left alone.
+//FIXME: links from the training set's old subs that a new pattern now sits between are left in place.  They cost
+//some traversal time but no accuracy, since the visit_set never counts a node twice at the same t_abs.
+void model::add_event(const event& e, unordered_set<pattern, pattern_hash> &relinked) {
+  training_clock++;
+  working.total_num_events++;
+
+  int training_set_offset = this->training_set_offset();
+  if(working.nodes[working.training_set].patt.empty() || e.t < training_set_offset) {
+    training_set_offset = e.t;
+    move_training_set(training_set_offset);
+  }
+  if(!training_events.empty() && e.t > training_events.rbegin()->first) {
+    //the usual case, training in order: the event goes on the end, without copying the rest of the training set
+    working.nodes.append_to_pattern(working.training_set, e.p, e.t - training_events.rbegin()->first);
+  } else {
+    occurrence training_occ = get_union(get_occurrence(working.nodes[working.training_set].patt, training_set_offset), get_occurrence(e));
+    working.nodes.set_pattern(working.training_set, get_pattern(training_occ));
+  }
+
+  mn_index base_case_node;
   if(e.p)
-    base_case_node = base_case_1;
+    base_case_node = working.base_case_1;
   else
-    base_case_node = base_case_0;
+    base_case_node = working.base_case_0;
 
-  base_case_node->reset_super_link(training_set, e.t - training_set_offset);
-  training_set->reset_sub_link(base_case_node, -(e.t - training_set_offset));
-  
-  //make sure common subsections of the training set exist
-  relink_common_subsections(training_occ, training_occ);
+  working.nodes.add_super_link(base_case_node, mn_link(working.training_set, training_set_offset - e.t));
+  training_events[e.t] = e.p;
+
+  int window_start;
+  pattern window = training_window(e.t - int(max_pattern_width), e.t + int(max_pattern_width), window_start);
+  relink_new_subsections(window, window_start, set<int>{e.t}, relinked);
+}
 
-  //relink the apex pattern (without modifying counts anywhere)
-  //FIXME: this does lots of extra work -really only the portions involving the new event need to be relinked.
-  relink(training_occ, false);
+//Train on a block of events at once.  The block is taken to be one stretch of time, with no other model's events in
+//between, for when this model is merged.  Each event is added and relinked in time order just as train(event) would,
+//so with no memory constraint the block builds the same model as training its events one at a time.  What the block
+//saves is relinking a subsection the block has already relinked, which most subsections of a periodic stream are, and
+//running optimize(), the compaction and the publish bookkeeping once instead of once per event.
+//Searching the whole block window for common subsections in one pass was tried, and found them maximal over events
+//that had not arrived yet at the time of each sighting: queries came out up to 27 bits away from sequential training.
+//With a memory constraint optimize() only gets to run at the end of the block, so the model can overshoot the
+//constraint by what the block adds, and may evict different patterns than sequential training would.
+void model::train(const vector<event>& events) {
+  if(events.empty())
+    return;
+
+  vector<event> block = events;
+  sort(block.begin(), block.end());
+  unordered_set<pattern, pattern_hash> relinked;
+  for(const event& e : block)
+    add_event(e, relinked);
+  add_stretch(block.front().t, block.back().t);
+  trim_training_events();
   
   //optimize to within memory_constraint.  This DOES affect returned statistics.
+
+  optimize(memory_constraint);
+
+  //fold links added by this round of training back into contiguous storage
+  if(working.nodes.needs_compaction())
+    working.nodes.compact();
+
+  events_since_publish += events.size();
+  if(events_since_publish >= publish_interval)
+    publish();
+}
+
+//Where the training set sits in absolute time
+int model::training_set_offset() const {
+  int offset = 0;
+  working.nodes.for_each_super_link(working.training_set, [&](const mn_link& l) { if(l.node == working.apex) offset = l.t_offset; });
+  return offset;
+}
+
+//The training set pattern starts at its first event, so when an earlier event arrives it starts somewhere else.
+//A super link holds where the super starts relative to the sub, so every link into the training set has to move too.
+void model::move_training_set(int offset) {
+  int shift = offset - training_set_offset();
+  if(shift == 0)
+    return;
+
+  for(mn_index n = 0;n < working.nodes.size();n++) {
+    if(!working.nodes[n].in_use || n == working.training_set)
+      continue;
+
+    vector<mn_link> supers;
+    working.nodes.get_super_links(n, supers);
+    working.nodes.remove_super_links(n, working.training_set); //all of them first, or a moved link could land on one not moved yet
+    for(const mn_link& l : supers) {
+      if(l.node == working.training_set)
+	working.nodes.add_super_link(n, mn_link(l.node, l.t_offset + shift));
+    }
+  }
+  working.nodes.remove_super_links(working.training_set, working.apex);
+  working.nodes.add_super_link(working.training_set, mn_link(working.apex, offset));
+}
+
+/*
+  Fold another model, trained on a disjoint part of the event stream, into this one.
+  Patterns are unified by their canonical form (the pattern itself, which holds relative times only): a pattern both
+  models have gets the sum of the counts, and a pattern only the shard has is added.  The shard's links are carried
+  over through that mapping, with links into the shard's training set shifted to where the training set sits here.
+  Then the patterns this model did not have before are relinked so they take their place among the patterns it did,
+  and the edges of each of the shard's stretches of time are searched for common subsections that straddle the two.
+  Call publish() afterwards, or let the next train() do it.
+*/
+void model::merge(const model& shard) {
+  const model_state& from = shard.working;
+  vector<mn_index> node_map(from.nodes.size(), MN_NULL);
+  node_map[from.apex] = working.apex;
+  node_map[from.training_set] = working.training_set;
+  node_map[from.base_case_0] = working.base_case_0;
+  node_map[from.base_case_1] = working.base_case_1;
+  node_map[from.root] = working.root;
+
+  unordered_map<pattern, mn_index, pattern_hash> existing;
+  for(mn_index n = 0;n < working.nodes.size();n++) {
+    if(working.nodes[n].in_use && ok_to_delink(n))
+      existing[working.nodes[n].patt] = n;
+  }
+
+  //Unify the patterns and sum the counts
+  list<mn_index> added;
+  for(mn_index n = 0;n < from.nodes.size();n++) {
+    if(!from.nodes[n].in_use || node_map[n] != MN_NULL)
+      continue;
+
+    auto p_existing = existing.find(from.nodes[n].patt);
+    if(p_existing != existing.end()) {
+      node_map[n] = p_existing->second;
+      working.nodes[p_existing->second].count += from.nodes[n].count;
+    } else {
+      mn_index m = working.nodes.create();
+      working.nodes.set_pattern(m, from.nodes[n].patt);
+      working.nodes[m].count = from.nodes[n].count;
+      working.nodes[m].last_trained = training_clock;
+      node_map[n] = m;
+      existing[from.nodes[n].patt] = m;
+      added.push_back(m);
+    }
+  }
+
+  //The training set is the union of the two, and starts at whichever starts first
+  int shard_offset = shard.training_set_offset();
+  int this_offset = shard_offset;
+  if(!working.nodes[working.training_set].patt.empty())
+    this_offset = min(training_set_offset(), shard_offset);
+  occurrence training_occ = get_union(get_occurrence(working.nodes[working.training_set].patt, training_set_offset()), get_occurrence(from.nodes[from.training_set].patt, shard_offset));
+  move_training_set(this_offset);
+  working.nodes.set_pattern(working.training_set, get_pattern(training_occ));
+  for(auto p_e = shard.training_events.begin();p_e != shard.training_events.end();p_e++)
+    training_events[p_e->first] = p_e->second;
+  training_events_start = max(training_events_start, shard.training_events_start);
+  training_clock += shard.training_clock;
+  working.total_num_events += from.total_num_events;
+  if(promotion_threshold > 1 && shard.promotion_threshold > 1)
+    candidates.merge(shard.candidates); //the sighting counts of both stretches of time add up
+
+  //Carry the links over
+  for(mn_index n = 0;n < from.nodes.size();n++) {
+    if(!from.nodes[n].in_use || n == from.training_set)
+      continue; //the training set's only super is the apex, which is already linked
+
+    from.nodes.for_each_super_link(n, [&](const mn_link& l) {
+	int t_offset = l.t_offset;
+	if(l.node == from.training_set)
+	  t_offset += this_offset - shard_offset;
+
+	working.nodes.add_super_link(node_map[n], mn_link(node_map[l.node], t_offset));
+      });
+  }
+
+  //Reconcile: patterns new to this model may be subs or supers of patterns it already had
+  for(auto p_m = added.begin();p_m != added.end();p_m++) {
+    if(working.nodes[*p_m].in_use)
+      relink(get_occurrence(working.nodes[*p_m].patt, 0), false);
+  }
+
+  //Common subsections straddling an edge of one of the shard's stretches of time contain a shard event within
+  //max_pattern_width of that edge, so searching those windows the way train() does finds them all.  The shard may have
+  //trained on many stretches, with other models' events in between, so every edge is searched, and windows that
+  //overlap are searched as one.
+  vector< pair<int, int> > windows;
+  for(auto p_s = shard.stretches.begin();p_s != shard.stretches.end();p_s++) {
+    for(int edge : {p_s->first, p_s->second}) {
+      int t_lb = edge - int(max_pattern_width);
+      int t_ub = edge + int(max_pattern_width);
+      if(!windows.empty() && t_lb <= windows.back().second)
+	windows.back().second = max(windows.back().second, t_ub);
+      else
+	windows.push_back(make_pair(t_lb, t_ub));
+    }
+  }
+  unordered_set<pattern, pattern_hash> relinked;
+  for(auto p_w = windows.begin();p_w != windows.end();p_w++) {
+    set<int> edge_times;
+    int shard_window_start;
+    pattern shard_window = shard.training_window(p_w->first, p_w->second, shard_window_start);
+    for(event_ptr p_e = shard_window.begin(shard_window_start);p_e != shard_window.end();++p_e)
+      edge_times.insert((*p_e).t);
+
+    int window_start;
+    pattern window = training_window(p_w->first, p_w->second, window_start);
+    relink_new_subsections(window, window_start, edge_times, relinked);
+  }
+  for(auto p_s = shard.stretches.begin();p_s != shard.stretches.end();p_s++)
+    add_stretch(p_s->first, p_s->second);
+  trim_training_events();
+
   optimize(memory_constraint);
+  working.nodes.compact();
+}
+
+//Make the current state of training visible to queries.
+//Readers that are still using an older version keep it until they are done; it is freed on a later publish.
+void model::publish() {
+  working.version++;
+  model_state* new_state = new model_state(working);
+  new_state->precompute_local_probs();
+  const model_state* old_state = published.exchange(new_state);
+  if(old_state != NULL)
+    readers.retire([old_state]() { delete old_state; });
+  readers.reclaim();
+  query_cache.invalidate();
+  events_since_publish = 0;
+}
+
+void model::set_publish_interval(unsigned num_events) {
+  publish_interval = max(num_events, 1u);
+}
+
+/*
+  Lets a single query use several threads.  Where a node has at least fan_out_threshold supers, the walks in
+  global_prob() and find_terms() hand the supers to a pool of num_threads threads as tasks of their own.  Zero threads
+  walks serially, as before.  The answers are those of the serial walk, except that global_prob() adds its terms up in
+  another order, which can change the last bits.  Publishes, so the setting takes effect for the next query.
+  A query still running against an old version keeps the old pool until it is done with it.
+*/
+void model::set_query_threads(unsigned num_threads, unsigned fan_out_threshold) {
+  task_pool* old_pool = query_pool;
+  query_pool = (num_threads > 0 ? new task_pool(num_threads) : NULL);
+  working.pool = query_pool;
+  working.fan_out_threshold = max(fan_out_threshold, 2u);
+  publish();
+  if(old_pool != NULL)
+    readers.retire([old_pool]() { delete old_pool; });
+}
+
+//Results are always memoized within a query.  A nonzero size also keeps them across queries; zero turns that off.
+void model::set_shared_cache_size(unsigned max_entries) {
+  query_cache.resize(max_entries);
+}
+
+//Saves the latest published version, so it can be called from any thread while training goes on.
+//Events trained since the last publish() are not in it.
+bool model::save(const string& filename) const {
+  model_snapshot snap(*this);
+  return snap->save(filename);
+}
+
+//Replaces the whole model with a saved one and publishes it.  Queries can run against it straight away; training
+//picks up where the saved model left off.
+bool model::load(const string& filename) {
+  if(!working.load(filename))
+    return false;
+
+  training_events.clear();
+  training_events_start = INT_MIN;
+  const pattern& training_patt = working.nodes[working.training_set].patt;
+  for(event_ptr p_e = training_patt.begin(training_set_offset());p_e != training_patt.end();++p_e)
+    training_events[(*p_e).t] = (*p_e).p;
+  training_clock = training_events.size();
+  stretches.clear();
+  if(!training_events.empty())
+    add_stretch(training_events.begin()->first, training_events.rbegin()->first); //a snapshot does not keep them apart
+  trim_training_events();
+  publish();
+  return true;
+}
+
+double model::prob(const occurrence& occ) const {
+  model_snapshot snap(*this);
+  prob_memo memo(snap->version, &query_cache);
+  return snap->prob(occ, memo);
+}
+
+double model::conditional_prob(const occurrence& occ, const occurrence& givens) const {
+  model_snapshot snap(*this);
+  prob_memo memo(snap->version, &query_cache);
+  return snap->conditional_prob(occ, givens, memo);
+}
+
+//prob() of every occurrence in occs, from one walk of the DAG per BATCH_SIZE occurrences.  Much cheaper than asking
+//one at a time when the occurrences have most of their events in common.
+void model::prob(const vector<occurrence>& occs, vector<double> &probs) const {
+  model_snapshot snap(*this);
+  prob_memo memo(snap->version, &query_cache);
+  snap->prob(occs, probs, memo);
+}
+
+//log2 of prob(), for occurrences long enough that prob() would underflow.  -INFINITY for zero.
+double model::log2_prob(const occurrence& occ) const {
+  model_snapshot snap(*this);
+  prob_memo memo(snap->version, &query_cache);
+  return snap->log2_prob(occ, memo).to_log2();
+}
+
+double model::log2_conditional_prob(const occurrence& occ, const occurrence& givens) const {
+  model_snapshot snap(*this);
+  prob_memo memo(snap->version, &query_cache);
+  return snap->log2_conditional_prob(occ, givens, memo).to_log2();
+}
+
+completion_set model::get_first_order_completions(const occurrence& occ) const {
+  model_snapshot snap(*this);
+  prob_memo memo(snap->version, &query_cache);
+  return snap->get_first_order_completions(occ, memo);
+}
+
+//Member functions of the snapshot
+model_snapshot::model_snapshot(const model& m) : m(m) {
+  slot = m.readers.enter();
+  state = m.published.load();
+}
+
+model_snapshot::~model_snapshot() {
+  m.readers.leave(slot);
 }
  
-double model::prior_count(unsigned pattern_length) const {
-  double prior_position_density = PRIOR_EVENT_DENSITY/(double(p_bounds.ub - p_bounds.lb));
+double model_state::prior_count(unsigned pattern_length) const {
+  double prior_position_density = PRIOR_EVENT_DENSITY/double(NUM_POSITIONS);
   return pow(prior_position_density, pattern_length)*PRIOR_INTERVAL;
 }
 
-//FIXME: if we ever run this algorithm in parallel there will have to be some more
-//sophisticated method than this for visiting each node once.  It would be once
-//per thread not just once.  This also means we cannot change the visit id inside
-//any recursive function that is crawling the tree.
-unsigned model::get_new_visit_id() {
-  return ++current_visit_id;
+//Returns the size of the sample space a pattern is counted over
+//Every pattern is counted over the whole training set, so the sample size is the same for all of them.
+double model_state::sample_size() const {
+  return total_num_events + 1.0;  //might be wrong - time based not event based?
+}
+
+//Returns probability of getting this pattern but not any super-pattern
+double model_state::local_prob(mn_index n) const {
+  const model_node& node = nodes[n];
+  return (node.count + prior_count(node.patt.p.size()))/(sample_size() + prior_count(0));  //this could be made faster but this is elegant
 }
 
-//Returns the size of the sample space containing p
-//FIXME: sample size is now the same for all patterns, rewrite this
-double model::sample_size(const pattern& p) {
-  return total_num_events - p.total_events_at_creation + 1.0;  //might be wrong - time based not event based?
+//local_prob() in the log domain, as a magnitude and a sign.  A published state has it for every node already.
+log_prob model_state::log_local_prob(mn_index n, bool &negative) const {
+  if(n < log_local.size()) {
+    negative = local_negative[n];
+    return log_local[n];
+  }
+
+  double p = local_prob(n);
+  negative = (p < 0.0);
+  return log_prob::from_double(fabs(p));
 }
 
-//Returns probability of getting this pattern but not any super-pattern
-double model::local_prob(const pattern& p) const {
-  return (p.count + prior_count(p.p.size()))/(sample_size(p) + prior_count(0));  //this could be made faster but this is elegant
+//A published state never changes, so every query against it can share one log2() per node instead of paying for it
+//on every visit.  model::publish() calls this on each new version before handing it to the readers.
+void model_state::precompute_local_probs() {
+  log_local.assign(nodes.size(), log_prob());
+  local_negative.assign(nodes.size(), false);
+  for(mn_index n = 0;n < nodes.size();n++) {
+    if(!nodes[n].in_use)
+      continue;
+
+    double p = local_prob(n);
+    local_negative[n] = (p < 0.0);
+    log_local[n] = log_prob::from_double(fabs(p));
+  }
 }
 
+/*
+  Shared by the tasks of one parallel walk of the DAG.  Each forked task walks with a visited set of its own, so no
+  task ever waits on another to mark a node; the price is that a node reachable from the subtrees of two tasks can be
+  walked by both, and what the tasks find is reconciled once they are done.
+  Forking follows a fixed rule, so the tasks are the same on every run: only the thread that starts the walk forks,
+  handing off every super but the first of each node it reaches with at least fan_out_threshold supers.  The tasks
+  walk their subtrees serially.
+*/
+class parallel_walk {
+public:
+  parallel_walk(task_pool& pool) : group(pool) {}
+  void add_found(vector<node_visit> &task_found) {
+    lock_guard<mutex> guard(lock);
+    found.push_back(vector<node_visit>());
+    found.back().swap(task_found);
+  }
+  task_group group;
+  mutex lock;
+  list< vector<node_visit> > found;
+};
+
 //Returns the total probability of getting this occ - but only works out of context
 //FIXME: explain why this works.  Negative counts and diamond subpatterns and all.
-double model::global_prob(const occurrence& occ, const pattern& patt, int t_abs, unsigned visit_id) {
-  if(visit_id == UINT_MAX)
-    visit_id = get_new_visit_id();
-  
-  if(already_visited(patt, visit_id, t_abs) || !is_compatible(occ, patt, t_abs))
+log_prob model_state::global_prob(const occurrence& occ, visit_set &visited) const {
+  log_sum sum;
+  if(pool == NULL) {
+    global_prob(occ, sum, visited, root, 0);
+    return sum.total();
+  }
+
+  //Gather every matching node from all the tasks, drop the ones more than one task found, and add them up in
+  //node order, so the sum comes out the same whichever thread found what.
+  vector<node_visit> found;
+  parallel_walk walk(*pool);
+  collect_global_prob(occ, found, visited, root, 0, &walk);
+  walk.group.wait();
+  for(auto p_found = walk.found.begin();p_found != walk.found.end();p_found++)
+    found.insert(found.end(), p_found->begin(), p_found->end());
+  sort(found.begin(), found.end());
+  found.erase(unique(found.begin(), found.end()), found.end());
+
+  for(const node_visit& v : found) {
+    bool negative;
+    log_prob p = log_local_prob(v.first, negative);
+    sum.add(p, negative);
+  }
+  return sum.total();
+}
+
+//global_prob() split into tasks: the same walk, but it lists the nodes whose local probability goes in the sum.
+//A forked task passes no walk, and so collects its subtree without forking again.
+void model_state::collect_global_prob(const occurrence& occ, vector<node_visit> &found, visit_set &visited, mn_index n, int t_abs, parallel_walk* walk) const {
+  if(!visited.insert(n, t_abs) || !is_compatible(occ, n, t_abs))
     return;
-  
-  mark_visited(patt, visit_id, t_abs);
 
-  double prob = 0.0;
-  if(is_sub_occurrence(get_occurrence(patt, t_abs), occ)) //This pattern is equal or a superset of occ, add the probability
-    prob += local_prob(patt);
+  if(is_sub_occurrence(get_occurrence(nodes[n].patt, t_abs), occ))
+    found.push_back(node_visit(n, t_abs));
 
-  //Add the probability of the super patterns
-  list<patt_link> super_patterns;
-  get_super_patterns(occ, patt, supers);
-  for(auto p_link = super_patterns.begin();p_link != super_patterns.end();p_link++)
-    prob += global_prob(occ, *(p_link.p_patt), t_abs + p_link->t_offset, visit_id);
+  vector<mn_link> supers;
+  for_each_super(nodes, n, occ, [&](const mn_link& l) { supers.push_back(l); });
+  for(unsigned i = 0;i < supers.size();i++) {
+    int super_t_abs = t_abs + supers[i].t_offset;
+    if(i == 0 || walk == NULL || supers.size() < fan_out_threshold) {
+      collect_global_prob(occ, found, visited, supers[i].node, super_t_abs, walk);
+      continue;
+    }
+
+    mn_index super = supers[i].node;
+    walk->group.run([this, &occ, walk, super, super_t_abs]() {
+	vector<node_visit> task_found;
+	visit_set task_visited;
+	collect_global_prob(occ, task_found, task_visited, super, super_t_abs, NULL);
+	walk->add_found(task_found);
+      });
+  }
+}
+
+//The sum is carried in the log domain, with any negative local probabilities kept apart until the end.
+void model_state::global_prob(const occurrence& occ, log_sum &sum, visit_set &visited, mn_index n, int t_abs) const {
+  if(!visited.insert(n, t_abs) || !is_compatible(occ, n, t_abs))
+    return;
 
-  return prob;
+  if(is_sub_occurrence(get_occurrence(nodes[n].patt, t_abs), occ)) { //This pattern is equal or a superset of occ, add the probability
+    bool negative;
+    log_prob p = log_local_prob(n, negative);
+    sum.add(p, negative);
+  }
+
+  //Add the probability of the super patterns
+  for_each_super(nodes, n, occ, [&](const mn_link& l) {
+      global_prob(occ, sum, visited, l.node, t_abs + l.t_offset);
+    });
 }
 
 //Find the top level terms necessary to find P(occ)
-void model::find_terms(const occurrence& occ, list<occurrence> &terms, pattern& patt, int t_abs, unsigned visit_id) const {
-  if(visit_id == UINT_MAX)
-    visit_id = get_new_visit_id();
+//With a walk, the supers of a node with enough of them are searched as parallel tasks, and the first is searched here.
+//The terms come out the same as a serial walk's.  A serial walk lists each node the first time it reaches it, in link
+//order, and prune_sub_terms() keeps a term unless a term listed before it contains it.  Putting the tasks' terms back
+//together in link order lists every node at the same place as the serial walk does.  A task, whose visited set starts
+//out empty, may list a node again that the serial walk had already reached, but only after the first listing, which
+//contains the copy, so pruning drops it.  The walk here marks what it visits in link order too, so it never skips a
+//node that the serial walk would list at that point.
+void model_state::find_terms(const occurrence& occ, list<occurrence> &terms, visit_set &visited, mn_index n, int t_abs, parallel_walk* walk) const {
+  if(n == MN_NULL)
+    n = root;
   
-  if(already_visited(patt, visit_id, t_abs) || !is_compatible(occ, patt, t_abs))
+  if(!visited.insert(n, t_abs) || !is_compatible(occ, n, t_abs))
     return;
   
-  mark_visited(patt, visit_id, t_abs);
-  
-  list<patt_link> super_patterns;
-  get_super_patterns(occ, patt, supers);
-  
   //Based on the super patterns, get the super terms.
   list<occurrence> new_terms;
   //Add onto the list this pattern, locally.
-  new_terms.push_back(get_occurrence(patt, t_abs));
+  new_terms.push_back(get_occurrence(nodes[n].patt, t_abs));
 
   //Get the terms corresponding to super patterns of patt.
-  for(auto p_link = super_patterns.begin();p_link != super_patterns.end();p_link++) {
-    find_terms(occ, new_terms, *(p_link.p_patt), t_abs + p_link->t_offset, visit_id);
+  vector<mn_link> supers;
+  for_each_super(nodes, n, occ, [&](const mn_link& l) { supers.push_back(l); });
+  if(walk != NULL && supers.size() >= fan_out_threshold) {
+    vector< list<occurrence> > super_terms(supers.size());
+    task_group group(*pool);
+    for(unsigned i = 1;i < supers.size();i++) {
+      group.run([this, &occ, &super_terms, &supers, i, t_abs]() {
+	  visit_set task_visited;
+	  find_terms(occ, super_terms[i], task_visited, supers[i].node, t_abs + supers[i].t_offset, NULL);
+	});
+    }
+    find_terms(occ, super_terms[0], visited, supers[0].node, t_abs + supers[0].t_offset, walk);
+    group.wait();
+
+    for(auto p_terms = super_terms.begin();p_terms != super_terms.end();p_terms++)
+      new_terms.splice(new_terms.end(), *p_terms);
+  } else {
+    for(const mn_link& l : supers)
+      find_terms(occ, new_terms, visited, l.node, t_abs + l.t_offset, walk);
   }
+
+  prune_sub_terms(new_terms);
   
+  //Append new_terms to terms
+  terms.splice(terms.end(), new_terms);
+}
+
+/*
+  find_terms() for a batch of occurrences in one walk.  Bit i of mask stands for occs[i].  A node is visited once for
+  every occurrence that reaches it, and only those of its supers compatible with that occurrence are followed for
+  it, just as find_terms() on the occurrence alone would do, and in the same order.  So every occurrence gets exactly
+  the terms find_terms() would give it, but the nodes the occurrences have in common are only read once.
+*/
+void model_state::find_terms(const vector<occurrence>& occs, batch_mask mask, vector< list<occurrence> > &terms, batch_visits &visited, mn_index n, int t_abs) const {
+  batch_mask& seen = visited[node_visit(n, t_abs)];
+  mask &= ~seen;
+  seen |= mask;
+  if(mask == 0)
+    return;
+
+  occurrence n_occ = get_occurrence(nodes[n].patt, t_abs);
+  for(unsigned i = 0;i < occs.size();i++) {
+    if((mask & (1ull << i)) && !is_single_valued(get_union(occs[i], n_occ)))
+      mask &= ~(1ull << i);
+  }
+  if(mask == 0)
+    return;
+
+  vector< list<occurrence> > new_terms(occs.size());
+  for(unsigned i = 0;i < occs.size();i++) {
+    if(mask & (1ull << i))
+      new_terms[i].push_back(n_occ);
+  }
+
+  //The root has a super at the time of every event of the target occurrence.  Taking the times of all the
+  //occurrences in order keeps the order each one would see on its own.
+  if(nodes[n].patt.p.empty()) {
+    map<int, batch_mask> times;
+    for(unsigned i = 0;i < occs.size();i++) {
+      if(mask & (1ull << i)) {
+	for(auto p_e = occs[i].cbegin();p_e != occs[i].cend();p_e++)
+	  times[p_e->t] |= (1ull << i);
+      }
+    }
+    for(auto p_time = times.begin();p_time != times.end();p_time++)
+      nodes.for_each_super_link(n, [&](const mn_link& l) { find_terms(occs, p_time->second, new_terms, visited, l.node, p_time->first); });
+  } else
+    nodes.for_each_super_link(n, [&](const mn_link& l) { find_terms(occs, mask, new_terms, visited, l.node, t_abs + l.t_offset); });
+
+  for(unsigned i = 0;i < occs.size();i++) {
+    if(mask & (1ull << i)) {
+      prune_sub_terms(new_terms[i]);
+      terms[i].splice(terms[i].end(), new_terms[i]);
+    }
+  }
+}
+
+//Drops the terms which the other terms found at the same node make redundant.
+void model_state::prune_sub_terms(list<occurrence> &new_terms) {
   //For each pair of new terms:
-  for(auto p_term_a = new_terms.begin();p_term_a != new_terms.end();p_term++) {
+  for(auto p_term_a = new_terms.begin();p_term_a != new_terms.end();p_term_a++) {
     auto p_term_b = p_term_a;
     p_term_b++;  //Don't compare the term with itself
     while(p_term_b != new_terms.end()) {
-      if(is_sub_occurrence(p_term_a->occ, p_term_b->occ)) {
+      if(is_sub_occurrence(*p_term_a, *p_term_b)) {
 	//Remove terms which are a strict sub of another term (not equal) in the occ.
 	//This is because the smaller one's probability would be divided out of the
 	//total probability for the multiplied terms anyway.
@@ -513,33 +1236,105 @@ void model::find_terms(const occurrence& occ, list<occurrence> &terms, pattern&
 	p_term_b++;
     }
   }
-  
-  //Append new_terms to terms
-  terms.splice(terms.end(), new_terms);
 }
 
-double model::prob(const occurrence& occ) {
+double model_state::prob(const occurrence& occ) const {
+  prob_memo memo(version);
+  return prob(occ, memo);
+}
+
+//Underflows to zero for long occurrences; log2_prob() does not.
+double model_state::prob(const occurrence& occ, prob_memo &memo) const {
+  return log2_prob(occ, memo).to_double();
+}
+
+//The product of the terms, with their overlaps divided out.  It is all done on log_probs, so a product over
+//thousands of events does not underflow, and every multiply and divide is an integer add or subtract.
+//Every result is remembered in memo, so the intersections that come up again in the recursion, or in the other
+//queries sharing the memo, are only computed once.
+log_prob model_state::log2_prob(const occurrence& occ, prob_memo &memo) const {
+  pattern occ_patt = get_pattern(occ);
+  log_prob memo_prob;
+  if(memo.find(PROB_TERM, occ_patt, memo_prob))
+    return memo_prob;
+
   //Find the terms necessary to make occ
   list<occurrence> terms;
-  find_terms(occ, terms);
+  visit_set visited;
+  if(pool != NULL) {
+    parallel_walk walk(*pool);
+    find_terms(occ, terms, visited, root, 0, &walk);
+  } else
+    find_terms(occ, terms, visited);
+
+  return product_of_terms(occ, terms, memo);
+}
+
+/*
+  prob() for many occurrences at once.  Meant for occurrences which are much alike, such as the candidate completions
+  of one set of givens: their terms are found in one walk of the DAG, up to BATCH_SIZE at a time, and the terms and
+  overlaps they have in common are only worked out once, by way of the memo.
+*/
+void model_state::log2_prob(const vector<occurrence>& occs, vector<log_prob> &probs, prob_memo &memo) const {
+  probs.assign(occs.size(), log_prob());
+  for(unsigned begin = 0;begin < occs.size();begin += BATCH_SIZE) {
+    vector<occurrence> batch;
+    vector<unsigned> batch_index;
+    for(unsigned i = begin;i < occs.size() && i < begin + BATCH_SIZE;i++) {
+      if(!memo.find(PROB_TERM, get_pattern(occs[i]), probs[i])) {
+	batch.push_back(occs[i]);
+	batch_index.push_back(i);
+      }
+    }
+    if(batch.empty())
+      continue;
+
+    vector< list<occurrence> > terms(batch.size());
+    batch_visits visited;
+    batch_mask all = (batch.size() == BATCH_SIZE ? ~0ull : (1ull << batch.size()) - 1);
+    find_terms(batch, all, terms, visited, root, 0);
+    for(unsigned j = 0;j < batch.size();j++)
+      probs[batch_index[j]] = product_of_terms(batch[j], terms[j], memo);
+  }
+}
+
+void model_state::prob(const vector<occurrence>& occs, vector<double> &probs, prob_memo &memo) const {
+  vector<log_prob> log_probs;
+  log2_prob(occs, log_probs, memo);
+  probs.resize(occs.size());
+  for(unsigned i = 0;i < occs.size();i++)
+    probs[i] = log_probs[i].to_double();
+}
+
+//The product of the terms of occ, with their overlaps divided out, which is P(occ).
+log_prob model_state::product_of_terms(const occurrence& occ, const list<occurrence> &terms, prob_memo &memo) const {
+  visit_set visited;
 
   //Take the conditional product of terms which are different in the occ
   occurrence current_occ;
-  double current_prob = 1.0;
+  log_prob current_prob = log_prob::one();
 
   //For each term, divide out the overlap between this term and the last by calling prob recursively
   for(auto p_term = terms.begin();p_term != terms.end();p_term++) {
-    current_prob *= global_prob(*p_term);
+    pattern term_patt = get_pattern(*p_term);
+    log_prob term_prob;
+    if(!memo.find(GLOBAL_PROB_TERM, term_patt, term_prob)) {
+      visited.reset();
+      term_prob = global_prob(*p_term, visited);
+      memo.insert(GLOBAL_PROB_TERM, term_patt, term_prob);
+    }
+    current_prob *= term_prob;
     occurrence intersection_occ = get_intersection(current_occ, *p_term);
 
     //Divide out the probability of the common part, since we are assuming that our patterns are
-    //coniditionally independent wrt their common parts.  Do it by calling this function recursively.
+    //coniditionally independent wrt their common parts.  Do it by calling log2_prob() recursively.
     if(!intersection_occ.empty()) 
-      current-prob /= prob(intersection_occ);
+      current_prob /= log2_prob(intersection_occ, memo);
   }
 
   //Return the product
-  return current.prob;
+  memo.insert(PROB_TERM, get_pattern(occ), current_prob);
+  return current_prob;
 }
 
 //Find conditional probability
@@ -588,8 +1383,18 @@ answer for a given tick they might not add up to one.  That's ok; we can call th
 function instead which has a cumulative_prob method that you can use to normalize the answer and adjust the
 configuration space with the new information.
 */
-double model::conditional_prob(const occurrence& occ, const occurrence& givens) {
-  return prob(get_union(occ, givens))/prob(givens);
+double model_state::conditional_prob(const occurrence& occ, const occurrence& givens) const {
+  prob_memo memo(version);
+  return conditional_prob(occ, givens, memo);
+}
+
+double model_state::conditional_prob(const occurrence& occ, const occurrence& givens, prob_memo &memo) const {
+  return log2_conditional_prob(occ, givens, memo).to_double();
+}
+
+//The ratio is taken between logs, so it comes out right even when both probabilities would underflow a double.
+log_prob model_state::log2_conditional_prob(const occurrence& occ, const occurrence& givens, prob_memo &memo) const {
+  return log2_prob(get_union(occ, givens), memo)/log2_prob(givens, memo);
 }
 
 //Since the calling code does not a lot of information about the internal state of the mode, we have to make
@@ -598,67 +1403,78 @@ double model::conditional_prob(const occurrence& occ, const occurrence& givens)
 //We also want to know what the potential events are at that tick, so that we can ask for the probability.
 //This function supplies both those things.  I'm calling it a "heuristic" function, where "heuristic"
 //is a latin word meaning "really I'm just guessing"
-void model::get_completion_heuristics(const occurrence& occ,
-				      map<int, double> total_prob_heuristic, //Adds up probability in a way that strictly speaking makes no sense
-				      map<int, vector<event> > events_to_return_heuristic,
-				      const pattern& patt,
-				      int t_abs,
-				      unsigned visit_id) {
-  if(already_visited(patt, visit_id, t_abs) || !match(occ, patt, t_abs))
+//The heuristics add up probability in a way that strictly speaking makes no sense.
+//They used to be taken by value, so everything the supers added was thrown away; now they accumulate in place.
+void model_state::get_completion_heuristics(const occurrence& occ,
+					    heuristic_accumulator &heuristics,
+					    mn_index n,
+					    int t_abs,
+					    visit_set &visited) const {
+  if(!visited.insert(n, t_abs) || !is_match(occ, nodes[n].patt, t_abs))
     return;
   
-  mark_visited(patt, visit_id, t_abs);
-  
-  list<patt_link> super_patterns;
-  get_super_patterns(occ, patt, supers);
-  
   //Add heuristics for this pattern, locally.
-  occurrence patt_occ = get_occurrence(patt, t_abs);
-  for(auto p_event = patt_occ.begin();p_event != patt_occ.end();p_event++) {
-    total_prob_heuristic[p_event->t] += local_prob(patt);
-    events_to_return_heuristic[p_event->t].push_back(*p_event);
-  }
+  double n_prob = local_prob(n);
+  for(event_ptr p_e = nodes[n].patt.begin(t_abs);p_e != nodes[n].patt.end();++p_e)
+    heuristics.add(*p_e, n_prob);
 
   //Add in the heuristics corresponding to super patterns of patt.
-  for(auto p_link = super_patterns.begin();p_link != super_patterns.end();p_link++) {
-    get_completion_heruistics(occ, total_prob_heuristic, events_to_return_heuristic, *(p_link->p_patt), t_abs + p_link->t_offset, visit_id);
-  }
+  for_each_super(nodes, n, occ, [&](const mn_link& l) {
+      get_completion_heuristics(occ, heuristics, l.node, t_abs + l.t_offset, visited);
+    });
   
 }
 
 //Returns the best t_abs, and the list of explicit events at that t_abs.
-unsigned model::pick_best_t_abs(const occurrence& occ,
-				 vector<event> &explicit_events) {
-  map<int, double> total_prob_heuristic;
-  map<int, vector<event> > events_to_return_heuristic;
-  get_completion_heuristics(occ, total_prob_heuristic, events_to_return_heuristic, base_level_pattern, 0, get_new_visit_id());
+//Completion requests are the inner loop of prediction, so the scratch space is kept per thread and reused.
+unsigned model_state::pick_best_t_abs(const occurrence& occ,
+				      vector<event> &explicit_events) const {
+  static thread_local heuristic_accumulator heuristics;
+  heuristics.clear(occ.empty() ? 0 : occ[0].t);
+  visit_set visited;
+  get_completion_heuristics(occ, heuristics, root, 0, visited);
   
-  //Pick the best tick to expand and grab the list of events to try
-  unsigned best_t_abs = 0;
-  double best_total_prob = 0.0;
-  for(auto p_tph = total_prob_heuristic.begin();p_tph != total_prob_heuristic.end();p_tph++) {
-    if(p_tph->second > best_total_prob) {
-      best_t_abs = p_tph->first;
-      best_total_prob = p_tph->second;
+  //Pick the best tick to expand and grab the list of events to try.  Every pattern matching occ piles weight onto
+  //the ticks occ already has, so those are passed over; there can be no more of them than occ has events.
+  vector<int> best_ticks;
+  heuristics.top_ticks(occ.size() + 1, best_ticks);
+  int best_t_abs = (occ.empty() ? 0 : occ.back().t + 1); //with nothing to go on, guess the next tick
+  for(int t : best_ticks) {
+    auto p_e = lower_bound(occ.begin(), occ.end(), event(t, 0));
+    if(p_e == occ.end() || p_e->t != t) {
+      best_t_abs = t;
+      break;
     }
   }
 
-  explicit_events = events_to_return_heuristic[best_t_abs];
+  explicit_events = heuristics.events(best_t_abs);
   return best_t_abs;
 }
 
-//Return a completion_set containing information about all the first order events with their probability
-//at a particular absolute time.
-completion_set model::get_first_order_completions(const occurrence& occ) {
+//Return a completion_set for the best tick to add to occ: the probability of occ with a 1 at that tick, and with a 0.
+//The tick is given relative to the first event of occ, as the configuration space expects.
+completion_set model_state::get_first_order_completions(const occurrence& occ) const {
+  prob_memo memo(version);
+  return get_first_order_completions(occ, memo);
+}
+
+//The candidates all share the givens in occ, so one memo serves all of their prob() calls.
+completion_set model_state::get_first_order_completions(const occurrence& occ, prob_memo &memo) const {
   int t_abs;
   vector<event> events;
   t_abs = pick_best_t_abs(occ, events);
 
-  completion_set result_set(this, t_abs);
-  for(auto p_event = events.begin();p_event != events.end();p_event++) {
-    result_set.add_completion(*p_event, prob(get_union(get_occurrence(e), occ)));
-  }
-
+  //Both candidates differ from occ at the one tick, so work them out together
+  vector<occurrence> candidates;
+  candidates.push_back(get_union(get_occurrence(event(t_abs, 1)), occ));
+  candidates.push_back(get_union(get_occurrence(event(t_abs, 0)), occ));
+  vector<double> candidate_probs;
+  prob(candidates, candidate_probs, memo);
+
+  completion_set result_set;
+  result_set.t_offset = t_abs - (occ.empty() ? 0 : occ[0].t);
+  result_set.event_prob = candidate_probs[0];
+  result_set.complement_prob = candidate_probs[1];
   return result_set;
 }
 
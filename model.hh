@@ -5,15 +5,28 @@
 
 #include "occurrence.hh"
 #include "pattern.hh"
+#include "model_node.hh"
+#include "epoch.hh"
+#include "prob_cache.hh"
+#include "log_prob.hh"
+#include "snapshot.hh"
+#include "sketch.hh"
+#include "task_pool.hh"
+#include "heuristic.hh"
 #include <vector>
 #include <list>
 #include <map>
+#include <set>
+#include <unordered_set>
+#include <unordered_map>
 #include <iostream>
 #include <algorithm>
 #include <math.h>
 #include <cfloat>
 #include <chrono>
 #include <ctime>
+#include <atomic>
+#include <queue>
 using namespace std;
 
 #ifndef MODEL
@@ -38,37 +51,184 @@ using namespace std;
 */
 
 
-class model {
+typedef enum {SUB, SUPER, SIBLING, IDENTITY, NONE} patt_relation;
+
+const unsigned NUM_POSITIONS = 2; //the position of an event is a bool
+
+class parallel_walk;
+
+//A super link from sub to some other node, as found by get_sub_links().  Used when delinking.
+class sub_link {
+public:
+  sub_link(mn_index sub, const mn_link& link) { this->sub = sub; this->link = link; }
+  mn_index sub;
+  mn_link link; //the super link of sub which points at the node being searched for
+};
+
+//A node placed at an absolute time, as a walk of the DAG visits it
+typedef pair<mn_index, int> node_visit;
+
+class node_visit_hash {
+public:
+  size_t operator()(const node_visit& v) const { return v.first*2654435761u ^ unsigned(v.second)*40503u; }
+};
+
+//Batched queries walk the DAG for up to BATCH_SIZE occurrences at once; bit i of a mask stands for occurrence i.
+typedef unsigned long long batch_mask;
+const unsigned BATCH_SIZE = 64;
+typedef unordered_map<node_visit, batch_mask, node_visit_hash> batch_visits;
+
+/*
+  Everything a query needs: the node arena, the named nodes and the statistics.
+  The training thread owns one model_state and changes it freely.  Every so often it publishes an immutable copy,
+  and readers run their queries against the latest published copy without taking any locks.
+*/
+class model_state {
  public:
-  model(unsigned memory_constraint);
-  ~model();
-  void train(const occurrence &givens);
-  double prob(const occurrence& occ);
-  double conditional_prob(const occurrence& occ, const occurrence& givens);
-  completion_set get_first_order_completions(occurrence& occ, int t_abs);
+  model_state();
+  double prob(const occurrence& occ) const;
+  double prob(const occurrence& occ, prob_memo &memo) const;
+  double conditional_prob(const occurrence& occ, const occurrence& givens) const;
+  double conditional_prob(const occurrence& occ, const occurrence& givens, prob_memo &memo) const;
+  log_prob log2_prob(const occurrence& occ, prob_memo &memo) const;
+  log_prob log2_conditional_prob(const occurrence& occ, const occurrence& givens, prob_memo &memo) const;
+  void prob(const vector<occurrence>& occs, vector<double> &probs, prob_memo &memo) const;
+  void log2_prob(const vector<occurrence>& occs, vector<log_prob> &probs, prob_memo &memo) const;
+  completion_set get_first_order_completions(const occurrence& occ) const;
+  completion_set get_first_order_completions(const occurrence& occ, prob_memo &memo) const;
+  bool save(const string& filename) const;
+  bool load(const string& filename);
+  unsigned version;
+  void precompute_local_probs();
  private:
   double prior_count(unsigned pattern_length) const; //Assume an even prior distribution of events and patterns
-  double sample_size(const pattern& p);
+  double sample_size() const;
   bool is_match(const occurrence& occ, const pattern& p, int t_abs) const;
-  double local_prob(const pattern& p) const;
-  double global_prob(const occurrence& occ, const pattern& patt = base_level_pattern, int t_abs = 0, unsigned visit_id = UINT_MAX) const;
-  unsigned get_new_visit_id();
-  void find_terms(const occurrence& occ, list<term> &terms, pattern& patt = base_level_pattern, int t_abs = 0, unsigned visit_id = UINT_MAX) const;
-  void relink_common_subsections(const occurrence& occ1, const occurrence& occ2);
-  pattern* relink(const pattern& root, const occurrence& occ);
-  void find_context(const pattern& p_current, const occurrence& occ,
-		    list<pattern*> &supers,
-		    list<pattern*> &subs,
-		    list<pattern*> &siblings,
-		    pattern* &patt, unsigned visit_id);  
-  model_node* apex;
-  model_node* training_set;
-  model_node* base_case_0, base_case_1;
-  model_node* root;
-  unsigned memory_constraint;
-  unsigned current_visit_id;
+  bool is_compatible(const occurrence& occ, mn_index n, int t_abs) const;
+  double local_prob(mn_index n) const;
+  log_prob log_local_prob(mn_index n, bool &negative) const;
+  log_prob global_prob(const occurrence& occ, visit_set &visited) const;
+  void global_prob(const occurrence& occ, log_sum &sum, visit_set &visited, mn_index n, int t_abs) const;
+  void collect_global_prob(const occurrence& occ, vector<node_visit> &found, visit_set &visited, mn_index n, int t_abs, parallel_walk* walk) const;
+  void find_terms(const occurrence& occ, list<occurrence> &terms, visit_set &visited, mn_index n = MN_NULL, int t_abs = 0, parallel_walk* walk = NULL) const;
+  void find_terms(const vector<occurrence>& occs, batch_mask mask, vector< list<occurrence> > &terms, batch_visits &visited, mn_index n, int t_abs) const;
+  static void prune_sub_terms(list<occurrence> &new_terms);
+  log_prob product_of_terms(const occurrence& occ, const list<occurrence> &terms, prob_memo &memo) const;
+  void get_completion_heuristics(const occurrence& occ,
+				 heuristic_accumulator &heuristics,
+				 mn_index n,
+				 int t_abs,
+				 visit_set &visited) const;
+  unsigned pick_best_t_abs(const occurrence& occ, vector<event> &explicit_events) const;
+  void get_sub_links(mn_index target, mn_index search, list<sub_link> &subs, int t_abs, visit_set &visited) const;
+  patt_relation find_context(mn_index current,
+			     const occurrence& target_occ,
+			     list<mn_link> &supers,
+			     list<mn_link> &subs,
+			     list<mn_index> &siblings,
+			     mn_index &match,
+			     int t_abs,
+			     visit_set &visited) const;
+  model_node_arena nodes;
+  mn_index apex;
+  mn_index training_set;
+  mn_index base_case_0, base_case_1;
+  mn_index root;
+  double total_num_events;
   double PRIOR_EVENT_DENSITY = 1.0;
   double PRIOR_INTERVAL = 1.0;
+  vector<log_prob> log_local; //log_local_prob() for every node, or empty; see precompute_local_probs()
+  vector<bool> local_negative;
+  task_pool* pool; //runs the parallel walks of queries; NULL to walk serially.  Owned by the model.
+  unsigned fan_out_threshold; //a node needs this many supers before a walk forks them
+  friend class model;
+};
+
+//How optimize() picks the patterns to evict when the model is over its memory constraint.
+typedef enum {EVICT_BY_COUNT, EVICT_BY_RECENCY, EVICT_BY_INFORMATION} eviction_policy;
+
+/*
+  One thread may call train(); any number of threads may call the query functions at the same time.
+  Queries always see the most recently published model_state.  Publishing copies the whole model_state, so train()
+  only publishes once every DEFAULT_PUBLISH_INTERVAL events unless told otherwise, and a query issued after train()
+  returns may not see the latest events yet.  Call publish() when the readers need to catch up, or
+  set_publish_interval(1) to publish after every event and pay for a copy of the model each time.
+*/
+const unsigned DEFAULT_PUBLISH_INTERVAL = 256; //events
+
+class model {
+ public:
+  model(unsigned memory_constraint);
+  ~model();
+  void train(const event& e);
+  void train(const vector<event>& events);
+  void merge(const model& shard);
+  void publish();
+  void set_publish_interval(unsigned num_events);
+  void set_shared_cache_size(unsigned max_entries);
+  void set_eviction_policy(eviction_policy policy);
+  void set_max_pattern_width(unsigned width);
+  void set_promotion_threshold(unsigned threshold, unsigned sketch_width = 1 << 16);
+  void set_query_threads(unsigned num_threads, unsigned fan_out_threshold = 8);
+  bool save(const string& filename) const;
+  bool load(const string& filename);
+  double prob(const occurrence& occ) const;
+  double conditional_prob(const occurrence& occ, const occurrence& givens) const;
+  void prob(const vector<occurrence>& occs, vector<double> &probs) const;
+  double log2_prob(const occurrence& occ) const;
+  double log2_conditional_prob(const occurrence& occ, const occurrence& givens) const;
+  completion_set get_first_order_completions(const occurrence& occ) const;
+  unsigned long memory_used() const; //bytes, as the memory constraint counts them
+ private:
+  int training_set_offset() const;
+  void move_training_set(int offset);
+  bool ok_to_delink(mn_index n);
+  void distribute_counts(mn_index n, const list<sub_link> &sub_links);
+  void delink(mn_index n, list<sub_link> &sub_links);
+  double eviction_utility(mn_index n) const;
+  void optimize(unsigned memory_constraint);
+  void relink_common_subsections(const occurrence& occ1, const occurrence& occ2);
+  pattern training_window(int t_lb, int t_ub, int& window_start) const;
+  void trim_training_events();
+  void add_stretch(int first, int last);
+  void relink_new_subsections(const pattern& window, int window_start, const set<int>& new_times,
+			      unordered_set<pattern, pattern_hash> &relinked);
+  void add_event(const event& e, unordered_set<pattern, pattern_hash> &relinked);
+  mn_index relink(const occurrence& occ, bool only_new = true);
+  model_state working; //only ever touched by the training thread
+  atomic<const model_state*> published;
+  mutable epoch_reclaimer readers;
+  mutable shared_prob_cache query_cache;
+  unsigned publish_interval;
+  unsigned events_since_publish;
+  unsigned memory_constraint; //bytes
+  eviction_policy policy;
+  unsigned training_clock; //number of events trained
+  map<int, bool> training_events; //the recent events of the training set, indexed by time
+  int training_events_start; //training_events has every event from here on; the older ones are only in the training set
+  map<int, int> stretches; //first to last event of each stretch of time trained on, kept apart where others' events may fall
+
+
+  unsigned max_pattern_width; //in ticks; bounds how far from a new event training looks for common subsections
+  unsigned promotion_threshold; //times a new pattern must be seen before it gets a node; 1 means right away
+  count_min_sketch candidates; //how often each pattern not yet promoted has been seen
+  task_pool* query_pool;
+  friend class model_snapshot;
+};
+
+//Pins the latest published version of a model for as long as it is in scope, so several queries can be run against
+//one consistent version.  Never blocks the training thread.
+class model_snapshot {
+ public:
+  model_snapshot(const model& m);
+  ~model_snapshot();
+  const model_state& operator*() const { return *state; }
+  const model_state* operator->() const { return state; }
+ private:
+  model_snapshot(const model_snapshot&); //not copyable
+  const model& m;
+  unsigned slot;
+  const model_state* state;
 };
 
 #endif
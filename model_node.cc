@@ -0,0 +1,350 @@
+/*****
+      model_node.cc
+      Index-addressed storage for the nodes of the model and the super links between them
+******/
+
+#include "model_node.hh"
+
+bool operator==(const mn_link& l1, const mn_link& l2) {
+  return (l1.node == l2.node && l1.t_offset == l2.t_offset);
+}
+
+model_node::model_node() {
+  count = 0.0;
+  ref_count = 0;
+  last_trained = 0;
+  in_use = false;
+}
+
+//Heap memory held by a pattern.  vector<bool> packs its bits.
+unsigned long pattern_bytes(const pattern& p) {
+  return (p.p.capacity() + 7)/8 + p.dt.capacity()*sizeof(unsigned);
+}
+
+//Member functions of the arena
+model_node_arena::model_node_arena() {
+  link_begin_store.push_back(0);
+  point_at_store();
+  overlay_links = 0;
+  dead_links = 0;
+  total_pattern_bytes = 0;
+}
+
+//Borrowed CSR arrays are shared with the copy; the arena's own are copied and the copy must point at its own.
+model_node_arena::model_node_arena(const model_node_arena& other) {
+  *this = other;
+}
+
+model_node_arena& model_node_arena::operator=(const model_node_arena& other) {
+  if(this == &other)
+    return *this;
+
+  nodes = other.nodes;
+  free_nodes = other.free_nodes;
+  link_begin_store = other.link_begin_store;
+  link_store = other.link_store;
+  overlay = other.overlay;
+  overlay_links = other.overlay_links;
+  dead_links = other.dead_links;
+  total_pattern_bytes = other.total_pattern_bytes;
+  if(other.borrowed_from) {
+    link_begin = other.link_begin;
+    links = other.links;
+    num_csr_nodes = other.num_csr_nodes;
+    num_csr_links = other.num_csr_links;
+    borrowed_from = other.borrowed_from;
+  } else
+    point_at_store();
+
+  return *this;
+}
+
+mn_index model_node_arena::create() {
+  mn_index n;
+  if(!free_nodes.empty()) {
+    n = free_nodes.back();
+    free_nodes.pop_back();
+    nodes[n] = model_node();
+  } else {
+    n = nodes.size();
+    nodes.push_back(model_node());
+    overlay.push_back(vector<mn_link>());
+  }
+
+  nodes[n].in_use = true;
+  return n;
+}
+
+//The caller is responsible for making sure nothing links to n anymore.
+void model_node_arena::release(mn_index n) {
+  if(nodes[n].ref_count != 0)
+    cout << "ERROR: released a model node which still has links pointing to it.\n";
+
+  remove_super_links(n);
+  total_pattern_bytes -= pattern_bytes(nodes[n].patt);
+  nodes[n] = model_node();
+  free_nodes.push_back(n);
+}
+
+void model_node_arena::point_at_store() {
+  link_begin = link_begin_store.data();
+  links = link_store.data();
+  num_csr_nodes = link_begin_store.size() - 1;
+  num_csr_links = link_store.size();
+  borrowed_from.reset();
+}
+
+//Copies borrowed CSR arrays into the arena so they can be written.  After the first write this does nothing.
+void model_node_arena::own_links() {
+  if(!borrowed_from)
+    return;
+
+  link_begin_store.assign(link_begin, link_begin + num_csr_nodes + 1);
+  link_store.assign(links, links + num_csr_links);
+  point_at_store();
+}
+
+unsigned model_node_arena::size() const {
+  return nodes.size();
+}
+
+unsigned model_node_arena::live_count() const {
+  return nodes.size() - free_nodes.size();
+}
+
+void model_node_arena::set_pattern(mn_index n, const pattern& p) {
+  total_pattern_bytes -= pattern_bytes(nodes[n].patt);
+  nodes[n].patt = p;
+  total_pattern_bytes += pattern_bytes(nodes[n].patt);
+}
+
+//Adds an event at the end of the pattern of n in place, where set_pattern() would copy the whole pattern.
+void model_node_arena::append_to_pattern(mn_index n, bool p, unsigned delta_t) {
+  total_pattern_bytes -= pattern_bytes(nodes[n].patt);
+  nodes[n].patt.append(p, delta_t);
+  total_pattern_bytes += pattern_bytes(nodes[n].patt);
+}
+
+//What keeping node n costs: the node itself, its pattern and its super links.
+unsigned long model_node_arena::node_bytes(mn_index n) const {
+  return sizeof(model_node) + sizeof(unsigned) + pattern_bytes(nodes[n].patt) + num_super_links(n)*sizeof(mn_link);
+}
+
+//Everything the arena holds, including slack: tombstoned links and the slots of released nodes.
+unsigned long model_node_arena::memory_used() const {
+  return nodes.size()*(sizeof(model_node) + sizeof(unsigned) + sizeof(vector<mn_link>))
+    + total_pattern_bytes
+    + (num_csr_links + overlay_links)*sizeof(mn_link)
+    + free_nodes.size()*sizeof(mn_index);
+}
+
+//What the nodes in use take.  The slack in memory_used() goes away at the next compact(), or is reused before the
+//arena grows.
+unsigned long model_node_arena::live_memory_used() const {
+  return memory_used() - dead_links*sizeof(mn_link)
+    - free_nodes.size()*(sizeof(model_node) + sizeof(unsigned) + sizeof(vector<mn_link>) + sizeof(mn_index));
+}
+
+bool model_node_arena::add_super_link(mn_index n, const mn_link& link) {
+  bool found = false;
+  for_each_super_link(n, [&](const mn_link& l) { if(l == link) found = true; });
+  if(found)
+    return false; //already here
+
+  overlay[n].push_back(link);
+  overlay_links++;
+  nodes[link.node].ref_count++;
+  return true;
+}
+
+bool model_node_arena::remove_super_link(mn_index n, const mn_link& link) {
+  if(n < num_csr_nodes) {
+    for(unsigned i = link_begin[n];i < link_begin[n + 1];i++) {
+      if(links[i] == link) {
+	own_links();
+	link_store[i].node = MN_NULL;
+	dead_links++;
+	nodes[link.node].ref_count--;
+	return true;
+      }
+    }
+  }
+
+  for(auto p_link = overlay[n].begin();p_link != overlay[n].end();p_link++) {
+    if(*p_link == link) {
+      overlay[n].erase(p_link);
+      overlay_links--;
+      nodes[link.node].ref_count--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void model_node_arena::remove_super_links(mn_index n, mn_index link_node) {
+  if(n < num_csr_nodes) {
+    for(unsigned i = link_begin[n];i < link_begin[n + 1];i++) {
+      if(links[i].node != MN_NULL && (link_node == MN_NULL || links[i].node == link_node)) {
+	own_links();
+	nodes[links[i].node].ref_count--;
+	link_store[i].node = MN_NULL;
+	dead_links++;
+      }
+    }
+  }
+
+  auto p_link = overlay[n].begin();
+  while(p_link != overlay[n].end()) {
+    if(link_node == MN_NULL || p_link->node == link_node) {
+      nodes[p_link->node].ref_count--;
+      p_link = overlay[n].erase(p_link);
+      overlay_links--;
+    } else
+      p_link++;
+  }
+}
+
+unsigned model_node_arena::num_super_links(mn_index n) const {
+  unsigned num = 0;
+  for_each_super_link(n, [&](const mn_link&) { num++; });
+  return num;
+}
+
+void model_node_arena::get_super_links(mn_index n, vector<mn_link> &supers) const {
+  supers.clear();
+  for_each_super_link(n, [&](const mn_link& l) { supers.push_back(l); });
+}
+
+bool model_node_arena::needs_compaction() const {
+  return (overlay_links + dead_links > 64 && overlay_links + dead_links > num_csr_links/4);
+}
+
+//Rebuilds the CSR arrays with the overlay folded in and the tombstones removed.
+//Cost is linear in the number of links, so the model only does this once the overlay has grown to a fraction of the CSR array.
+void model_node_arena::compact() {
+  vector<unsigned> new_begin;
+  vector<mn_link> new_links;
+  new_begin.reserve(nodes.size() + 1);
+  new_links.reserve(num_csr_links - dead_links + overlay_links);
+
+  for(mn_index n = 0;n < nodes.size();n++) {
+    new_begin.push_back(new_links.size());
+    for_each_super_link(n, [&](const mn_link& l) { new_links.push_back(l); });
+    overlay[n].clear();
+  }
+  new_begin.push_back(new_links.size());
+
+  link_begin_store.swap(new_begin);
+  link_store.swap(new_links);
+  point_at_store();
+  overlay_links = 0;
+  dead_links = 0;
+}
+
+/*
+  Replaces the contents of the arena with a node table and CSR arrays read from a snapshot.  The node table is taken
+  over (restored_nodes is left empty); the CSR arrays are used where they lie, and keep_alive is held for as long as
+  they are, so the memory behind them stays valid.  csr_begin must have one entry per node plus one.
+  Reference counts are not stored in snapshots, so they are rebuilt from the links here.
+*/
+void model_node_arena::restore(vector<model_node> &restored_nodes, const unsigned* csr_begin, const mn_link* csr_links, shared_ptr<const void> keep_alive) {
+  nodes.clear();
+  nodes.swap(restored_nodes);
+  free_nodes.clear();
+  overlay.assign(nodes.size(), vector<mn_link>());
+  overlay_links = 0;
+  dead_links = 0;
+  total_pattern_bytes = 0;
+  link_begin_store.clear();
+  link_store.clear();
+
+  link_begin = csr_begin;
+  links = csr_links;
+  num_csr_nodes = nodes.size();
+  num_csr_links = csr_begin[nodes.size()];
+  borrowed_from = keep_alive;
+
+  for(mn_index n = nodes.size();n-- > 0;) { //backwards, so create() hands out the lowest free slot first
+    nodes[n].ref_count = 0;
+    if(!nodes[n].in_use)
+      free_nodes.push_back(n);
+    total_pattern_bytes += pattern_bytes(nodes[n].patt);
+  }
+
+  for(unsigned i = 0;i < num_csr_links;i++) {
+    if(links[i].node != MN_NULL)
+      nodes[links[i].node].ref_count++;
+  }
+}
+
+//Member functions of the visited set
+visit_set::visit_set(unsigned initial_size) {
+  unsigned size = 16;
+  while(size < initial_size)
+    size *= 2;
+
+  slot empty;
+  empty.node = MN_NULL;
+  empty.t_abs = 0;
+  empty.epoch = 0;
+  slots.assign(size, empty);
+  epoch = 1;
+  num_used = 0;
+}
+
+//Returns the slot holding (n, t_abs) in the current epoch, or the empty slot where it would go.
+unsigned visit_set::find_slot(mn_index n, int t_abs) const {
+  unsigned mask = slots.size() - 1;
+  unsigned i = (n*2654435761u ^ unsigned(t_abs)*40503u) & mask;
+  while(slots[i].epoch == epoch && (slots[i].node != n || slots[i].t_abs != t_abs))
+    i = (i + 1) & mask;
+
+  return i;
+}
+
+bool visit_set::insert(mn_index n, int t_abs) {
+  unsigned i = find_slot(n, t_abs);
+  if(slots[i].epoch == epoch)
+    return false;
+
+  slots[i].node = n;
+  slots[i].t_abs = t_abs;
+  slots[i].epoch = epoch;
+  num_used++;
+
+  if(num_used*2 > slots.size()) //keep the load factor under one half so the probe sequences stay short
+    grow();
+
+  return true;
+}
+
+bool visit_set::contains(mn_index n, int t_abs) const {
+  return slots[find_slot(n, t_abs)].epoch == epoch;
+}
+
+void visit_set::reset() {
+  epoch++;
+  num_used = 0;
+  if(epoch == 0) { //wrapped around; old stamps could now look current
+    for(slot& s : slots)
+      s.epoch = 0;
+    epoch = 1;
+  }
+}
+
+void visit_set::grow() {
+  vector<slot> old_slots;
+  old_slots.swap(slots);
+
+  slot empty;
+  empty.node = MN_NULL;
+  empty.t_abs = 0;
+  empty.epoch = 0;
+  slots.assign(old_slots.size()*2, empty);
+
+  for(const slot& s : old_slots) {
+    if(s.epoch == epoch)
+      slots[find_slot(s.node, s.t_abs)] = s;
+  }
+}
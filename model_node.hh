@@ -0,0 +1,141 @@
+/*****
+      model_node.hh
+      Index-addressed storage for the nodes of the model and the super links between them
+******/
+
+#include "pattern.hh"
+#include "count_codec.hh"
+#include <vector>
+#include <climits>
+#include <memory>
+using namespace std;
+
+#ifndef MODEL_NODE
+#define MODEL_NODE
+
+//Nodes are addressed by their index in the arena, never by pointer, so that the arena can grow without invalidating anything.
+typedef unsigned mn_index;
+const mn_index MN_NULL = UINT_MAX;
+
+class mn_link {
+public:
+  mn_link() {}
+  mn_link(mn_index node, int t_offset) { this->node = node; this->t_offset = t_offset; }
+  mn_index node;
+  int t_offset;
+};
+
+bool operator==(const mn_link& l1, const mn_link& l2);
+
+//How model_node stores its count; see count_codec.hh.  Counts are mostly small integers, so e.g.
+//-D'MODEL_COUNT_CODEC=fixed16_codec<2>' keeps them exact to a quarter and saves 8 bytes a node.
+#ifndef MODEL_COUNT_CODEC
+#define MODEL_COUNT_CODEC exact_codec
+#endif
+typedef MODEL_COUNT_CODEC model_count_codec;
+
+class model_node {
+public:
+  model_node();
+  pattern patt;
+  unsigned ref_count; //number of super links in the arena pointing at this node
+  unsigned last_trained; //training clock value when training last created or relinked this node
+  quantized<model_count_codec> count; //after the unsigneds, so a small count packs in with in_use
+  bool in_use;
+};
+
+/*
+  The arena owns every model_node and every super link.
+  Links are stored in compressed sparse row (CSR) form: the super links of node n are links[link_begin[n]] .. links[link_begin[n+1] - 1],
+  so that walking up the DAG reads contiguous memory instead of chasing list nodes.  A CSR array cannot take inserts cheaply, so links
+  added since the last compaction go in a small per-node overlay, and removed links are left in place as tombstones (node == MN_NULL).
+  compact() folds the overlay back into the CSR arrays and drops the tombstones.  Call it every so often; needs_compaction() says when.
+  Released node slots are kept on a free list and handed out again by create(), so indices held by the model stay valid.
+  The CSR arrays need not be the arena's own: restore() can point them into a loaded snapshot, usually a mapped file.
+  They are read from there in place and only copied into the arena the first time a link is removed or the arena compacts.
+*/
+class model_node_arena {
+public:
+  model_node_arena();
+  mn_index create();
+  void release(mn_index n);
+  model_node& operator[](mn_index n) { return nodes[n]; }
+  const model_node& operator[](mn_index n) const { return nodes[n]; }
+  unsigned size() const; //number of slots, including released ones
+  unsigned live_count() const;
+  void set_pattern(mn_index n, const pattern& p); //use this rather than assigning patt, so memory_used() stays right
+  void append_to_pattern(mn_index n, bool p, unsigned delta_t);
+  unsigned long node_bytes(mn_index n) const;
+  unsigned long memory_used() const;
+  unsigned long live_memory_used() const; //less the tombstones, and the released slots create() hands out again
+  bool add_super_link(mn_index n, const mn_link& link); //returns false if the link was already there
+  bool remove_super_link(mn_index n, const mn_link& link);
+  void remove_super_links(mn_index n, mn_index link_node = MN_NULL); //MN_NULL removes them all
+  unsigned num_super_links(mn_index n) const;
+  void get_super_links(mn_index n, vector<mn_link> &supers) const;
+  template<class F> void for_each_super_link(mn_index n, F f) const;
+  bool needs_compaction() const;
+  void compact();
+  void restore(vector<model_node> &restored_nodes, const unsigned* csr_begin, const mn_link* csr_links, shared_ptr<const void> keep_alive);
+  model_node_arena(const model_node_arena& other);
+  model_node_arena& operator=(const model_node_arena& other);
+private:
+  void point_at_store();
+  void own_links(); //copy on write for borrowed CSR arrays
+  vector<model_node> nodes;
+  vector<mn_index> free_nodes;
+  const unsigned* link_begin; //one entry per compacted node plus one; points at link_begin_store or into a snapshot
+  const mn_link* links; //points at link_store or into a snapshot
+  unsigned num_csr_nodes;
+  unsigned num_csr_links;
+  vector<unsigned> link_begin_store;
+  vector<mn_link> link_store;
+  shared_ptr<const void> borrowed_from; //keeps a snapshot's memory alive while the CSR arrays point into it; NULL if they don't
+  vector< vector<mn_link> > overlay;
+  unsigned overlay_links;
+  unsigned dead_links;
+  unsigned long total_pattern_bytes;
+};
+
+unsigned long pattern_bytes(const pattern& p);
+
+template<class F> void model_node_arena::for_each_super_link(mn_index n, F f) const {
+  if(n < num_csr_nodes) {
+    for(unsigned i = link_begin[n];i < link_begin[n + 1];i++) {
+      if(links[i].node != MN_NULL)
+	f(links[i]);
+    }
+  }
+  for(const mn_link& l : overlay[n])
+    f(l);
+}
+
+/*
+  The set of (node, t_abs) pairs visited by one traversal of the DAG.  We only want to visit each pattern one time with a
+  particular t_abs.  The set belongs to whoever is doing the traversal, not to the nodes, so any number of traversals can
+  run over the same arena at once.
+  It is an open-addressed hash table where each slot is stamped with the epoch it was written in; a slot from an older
+  epoch counts as empty.  That way reset() is O(1) and a traversal context can reuse the same table query after query.
+*/
+class visit_set {
+public:
+  visit_set(unsigned initial_size = 64);
+  bool insert(mn_index n, int t_abs); //returns false if (n, t_abs) was already visited
+  bool contains(mn_index n, int t_abs) const;
+  void reset();
+  unsigned size() const { return num_used; }
+private:
+  class slot {
+  public:
+    mn_index node;
+    int t_abs;
+    unsigned epoch;
+  };
+  unsigned find_slot(mn_index n, int t_abs) const;
+  void grow();
+  vector<slot> slots; //size is always a power of two
+  unsigned epoch;
+  unsigned num_used;
+};
+
+#endif
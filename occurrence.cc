@@ -0,0 +1,58 @@
+/*****
+      occurrence.cc
+      Events placed at absolute times, as a pattern is when it is matched against some data
+******/
+
+#include "occurrence.hh"
+#include <algorithm>
+
+occurrence get_occurrence(const pattern& p, int t_abs) {
+  occurrence occ;
+  for(event_ptr p_e = p.begin(t_abs);p_e != p.end();++p_e)
+    occ.push_back(*p_e);
+  if(!is_sorted(occ.begin(), occ.end())) //two positions at one tick can come out of a pattern either way round
+    sort(occ.begin(), occ.end());
+  return occ;
+}
+
+occurrence get_occurrence(const event& e) {
+  occurrence occ;
+  occ.push_back(e);
+  return occ;
+}
+
+pattern get_pattern(const occurrence& occ) {
+  pattern p;
+  for(unsigned i = 0;i < occ.size();i++)
+    p.append(occ[i].p, (i == 0 ? 0 : occ[i].t - occ[i - 1].t));
+  return p;
+}
+
+bool is_sub_occurrence(const occurrence& occ, const occurrence& sub) {
+  return includes(occ.begin(), occ.end(), sub.begin(), sub.end());
+}
+
+occurrence get_union(const occurrence& occ1, const occurrence& occ2) {
+  occurrence result;
+  set_union(occ1.begin(), occ1.end(), occ2.begin(), occ2.end(), back_inserter(result));
+  return result;
+}
+
+occurrence get_intersection(const occurrence& occ1, const occurrence& occ2) {
+  occurrence result;
+  set_intersection(occ1.begin(), occ1.end(), occ2.begin(), occ2.end(), back_inserter(result));
+  return result;
+}
+
+bool is_single_valued(const occurrence& occ) {
+  for(unsigned i = 1;i < occ.size();i++) {
+    if(occ[i].t == occ[i - 1].t)
+      return false;
+  }
+  return true;
+}
+
+//The common subsections of two occurrences do not depend on where either one is, only on their patterns
+void convolute(const occurrence& occ1, const occurrence& occ2, list<pattern>& result, int min_size) {
+  convolute(get_pattern(occ1), get_pattern(occ2), result, min_size);
+}
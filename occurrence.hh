@@ -0,0 +1,32 @@
+/*****
+      occurrence.hh
+      Events placed at absolute times, as a pattern is when it is matched against some data
+******/
+
+#include "pattern.hh"
+#include <vector>
+#include <list>
+using namespace std;
+
+#ifndef OCCURRENCE
+#define OCCURRENCE
+
+/*
+  A pattern only knows the time between its events; an occurrence is the same events placed at absolute times.
+  The events are kept sorted (by time, then position) with no duplicates, so the set operations below are all single
+  merges.  Two events at the same time with different positions are allowed, but such an occurrence is not single
+  valued and cannot actually happen.
+*/
+class occurrence : public vector<event> {
+};
+
+occurrence get_occurrence(const pattern& p, int t_abs); //the events of p, with the first one at t_abs
+occurrence get_occurrence(const event& e);
+pattern get_pattern(const occurrence& occ); //forgets the absolute times
+bool is_sub_occurrence(const occurrence& occ, const occurrence& sub); //true if every event of sub is in occ
+occurrence get_union(const occurrence& occ1, const occurrence& occ2);
+occurrence get_intersection(const occurrence& occ1, const occurrence& occ2);
+bool is_single_valued(const occurrence& occ);
+void convolute(const occurrence& occ1, const occurrence& occ2, list<pattern>& result, int min_size = 2);
+
+#endif
@@ -303,3 +303,12 @@ void convolute(const pattern& p1, const pattern& p2, list<pattern>& result, list
 }
 void convolute(const pattern& p1, const pattern& p2, list<pattern>& result, int min_size) { list<int> dummy; convolute(p1, p2, result, dummy, min_size); }
 
+unsigned long hash_pattern(const pattern& p) {
+  unsigned long h = 14695981039346656037ul; //FNV-1a
+  for(unsigned i = 0;i < p.p.size();i++) {
+    h = (h ^ (p.p[i] ? 1ul : 2ul))*1099511628211ul;
+    if(i < p.dt.size())
+      h = (h ^ p.dt[i])*1099511628211ul;
+  }
+  return h;
+}
@@ -107,5 +107,12 @@ pattern get_union(const pattern& p1, int t_offset, const pattern& p2, int& resul
 bool is_single_valued(const pattern& p);
 void convolute(const pattern& p1, const pattern& p2, list<pattern>& result, list<int>& result_offset, int min_size = 2);
 void convolute(const pattern& p1, const pattern& p2, list<pattern>& result, int min_size = 2);
+unsigned long hash_pattern(const pattern& p); //Patterns hold relative times only, so equal patterns at different shifts hash the same
+
+//So patterns can be used as keys in unordered containers
+class pattern_hash {
+public:
+  size_t operator()(const pattern& p) const { return hash_pattern(p); }
+};
 
 #endif
@@ -0,0 +1,97 @@
+/*****
+      prob_cache.cc
+      Memoization of probabilities computed by the model, within one query and across queries
+******/
+
+#include "prob_cache.hh"
+
+//Member functions of the shared cache
+shared_prob_cache::shared_prob_cache(unsigned max_entries) {
+  this->max_entries = max_entries;
+}
+
+bool shared_prob_cache::find(unsigned version, prob_kind kind, const pattern& p, log_prob& prob) {
+  unique_lock<mutex> guard(lock, try_to_lock);
+  if(!guard.owns_lock())
+    return false;
+
+  key k;
+  k.version = version;
+  k.kind = kind;
+  k.p = p;
+  auto p_entry = index.find(k);
+  if(p_entry == index.end())
+    return false;
+
+  entries.splice(entries.begin(), entries, p_entry->second);
+  prob = p_entry->second->second;
+  return true;
+}
+
+void shared_prob_cache::insert(unsigned version, prob_kind kind, const pattern& p, log_prob prob) {
+  unique_lock<mutex> guard(lock, try_to_lock);
+  if(!guard.owns_lock() || max_entries == 0)
+    return;
+
+  key k;
+  k.version = version;
+  k.kind = kind;
+  k.p = p;
+  auto p_entry = index.find(k);
+  if(p_entry != index.end()) {
+    p_entry->second->second = prob;
+    entries.splice(entries.begin(), entries, p_entry->second);
+    return;
+  }
+
+  entries.push_front(make_pair(k, prob));
+  index[k] = entries.begin();
+  if(entries.size() > max_entries) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+  }
+}
+
+//Called when the model publishes a new version.  Entries for the old version could still be hit by readers on an old
+//snapshot, but they are about to stop being useful, so don't keep them around.
+void shared_prob_cache::invalidate() {
+  lock_guard<mutex> guard(lock);
+  index.clear();
+  entries.clear();
+}
+
+void shared_prob_cache::resize(unsigned max_entries) {
+  lock_guard<mutex> guard(lock);
+  this->max_entries = max_entries;
+  while(entries.size() > max_entries) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+  }
+}
+
+//Member functions of the per query memo
+prob_memo::prob_memo(unsigned version, shared_prob_cache* shared) {
+  this->version = version;
+  this->shared = shared;
+}
+
+bool prob_memo::find(prob_kind kind, const pattern& p, log_prob& prob) {
+  auto p_entry = local[kind].find(p);
+  if(p_entry != local[kind].end()) {
+    prob = p_entry->second;
+    return true;
+  }
+
+  if(shared != NULL && shared->find(version, kind, p, prob)) {
+    local[kind][p] = prob;
+    return true;
+  }
+
+  return false;
+}
+
+void prob_memo::insert(prob_kind kind, const pattern& p, log_prob prob) {
+  local[kind][p] = prob;
+  if(shared != NULL)
+    shared->insert(version, kind, p, prob);
+}
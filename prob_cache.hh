@@ -0,0 +1,70 @@
+/*****
+      prob_cache.hh
+      Memoization of probabilities computed by the model, within one query and across queries
+******/
+
+#include "pattern.hh"
+#include "log_prob.hh"
+#include <unordered_map>
+#include <list>
+#include <mutex>
+using namespace std;
+
+#ifndef PROB_CACHE
+#define PROB_CACHE
+
+//The model caches two kinds of results for the same pattern; they must not be confused.
+typedef enum {PROB_TERM, GLOBAL_PROB_TERM} prob_kind;
+
+/*
+  Shared by every query against a model.  Entries are keyed by the version of the model they were computed against as
+  well as the pattern, so a reader on an old snapshot can never see a result from a newer one or vice versa.
+  Least recently used entries are evicted once the cache is full.
+  The cache is guarded by a mutex, but readers only ever try_lock it: if another thread holds it, the lookup counts as
+  a miss and the insert is skipped, so a query never waits on the cache.
+*/
+class shared_prob_cache {
+public:
+  shared_prob_cache(unsigned max_entries);
+  bool find(unsigned version, prob_kind kind, const pattern& p, log_prob& prob);
+  void insert(unsigned version, prob_kind kind, const pattern& p, log_prob prob);
+  void invalidate();
+  void resize(unsigned max_entries);
+private:
+  class key {
+  public:
+    unsigned version;
+    prob_kind kind;
+    pattern p;
+  };
+  class key_hash {
+  public:
+    size_t operator()(const key& k) const { return hash_pattern(k.p)*31 + k.version*2 + k.kind; }
+  };
+  class key_equal {
+  public:
+    bool operator()(const key& k1, const key& k2) const { return k1.version == k2.version && k1.kind == k2.kind && k1.p == k2.p; }
+  };
+  typedef list< pair<key, log_prob> > lru_list;
+  unsigned max_entries;
+  lru_list entries; //most recently used at the front
+  unordered_map<key, lru_list::iterator, key_hash, key_equal> index;
+  mutex lock;
+};
+
+/*
+  Lives for the duration of one query.  prob() calls itself on the intersection of every pair of terms, and the same
+  intersections come up over and over, so every result is remembered here first and handed on to the shared cache.
+*/
+class prob_memo {
+public:
+  prob_memo(unsigned version, shared_prob_cache* shared = NULL);
+  bool find(prob_kind kind, const pattern& p, log_prob& prob);
+  void insert(prob_kind kind, const pattern& p, log_prob prob);
+private:
+  unsigned version;
+  shared_prob_cache* shared;
+  unordered_map<pattern, log_prob, pattern_hash> local[2];
+};
+
+#endif
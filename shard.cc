@@ -0,0 +1,71 @@
+/*****
+      shard.cc
+      Train several models on disjoint parts of the event stream in parallel and merge them into one
+******/
+
+#include "shard.hh"
+
+sharded_trainer::sharded_trainer(unsigned num_shards, unsigned memory_constraint) {
+  for(unsigned i = 0;i < max(num_shards, 1u);i++) {
+    shards.push_back(new model(memory_constraint));
+    shards.back()->set_publish_interval(UINT_MAX); //nobody queries a shard, so don't pay for snapshots
+  }
+}
+
+sharded_trainer::~sharded_trainer() {
+  for(model* m : shards)
+    delete m;
+}
+
+//Give the model being merged into the same settings, or the shards' sketches cannot be merged into its sketch.
+void sharded_trainer::set_promotion_threshold(unsigned threshold, unsigned sketch_width) {
+  for(model* m : shards)
+    m->set_promotion_threshold(threshold, sketch_width);
+}
+
+//Give the model being merged into the same width, since merge() searches the edges of each stretch that far.
+void sharded_trainer::set_max_pattern_width(unsigned width) {
+  for(model* m : shards)
+    m->set_max_pattern_width(width);
+}
+
+void sharded_trainer::train(const vector<event>& events) {
+  vector<event> sorted_events = events;
+  sort(sorted_events.begin(), sorted_events.end());
+
+  vector< vector<event> > partitions(shards.size());
+  unsigned block_size = (sorted_events.size() + shards.size() - 1)/shards.size();
+  for(unsigned i = 0;i < sorted_events.size();i++)
+    partitions[i/block_size].push_back(sorted_events[i]);
+
+  train(partitions);
+}
+
+//Each partition is trained as a block of its own, so the shard knows where its stretches of time start and end and
+//merge() can search around every one of them.
+void sharded_trainer::train(const vector< vector<event> >& partitions) {
+  vector< vector<unsigned> > shard_partitions(shards.size());
+  for(unsigned i = 0;i < partitions.size();i++) {
+    if(!partitions[i].empty())
+      shard_partitions[i % shards.size()].push_back(i);
+  }
+
+  vector<thread> workers;
+  for(unsigned i = 0;i < shards.size();i++) {
+    if(!shard_partitions[i].empty())
+      workers.push_back(thread([this, i, &partitions, &shard_partitions]() {
+	    for(unsigned j : shard_partitions[i])
+	      shards[i]->train(partitions[j]);
+	  }));
+  }
+
+  for(thread& w : workers)
+    w.join();
+}
+
+void sharded_trainer::merge_into(model& m) const {
+  for(const model* shard : shards)
+    m.merge(*shard);
+
+  m.publish();
+}
@@ -0,0 +1,37 @@
+/*****
+      shard.hh
+      Train several models on disjoint parts of the event stream in parallel and merge them into one
+******/
+
+#include "model.hh"
+#include <vector>
+#include <thread>
+using namespace std;
+
+#ifndef SHARD
+#define SHARD
+
+/*
+  Each shard is an ordinary model with its own training set, trained on its own thread.  Nothing is shared between
+  shards while they train, so ingest scales with the number of shards.  merge_into() then folds every shard into one
+  queryable model with model::merge().
+  Partitions should be disjoint in time, and each one a stretch of time with no other partition's events inside it.  Patterns that repeat within max_pattern_width of each other are found whether
+  or not they cross a partition boundary, just as training one model on the whole stream would find them.
+  Merging does not empty the shards, so merge a shard's training into a model only once.
+*/
+class sharded_trainer {
+public:
+  sharded_trainer(unsigned num_shards, unsigned memory_constraint);
+  ~sharded_trainer();
+  void train(const vector<event>& events); //splits the events into one contiguous block of time per shard
+  void train(const vector< vector<event> >& partitions); //partition i goes to shard i % num_shards()
+  void merge_into(model& m) const;
+  void set_promotion_threshold(unsigned threshold, unsigned sketch_width = 1 << 16); //see model::set_promotion_threshold()
+  void set_max_pattern_width(unsigned width); //see model::set_max_pattern_width()
+  unsigned num_shards() const { return shards.size(); }
+private:
+  sharded_trainer(const sharded_trainer&); //not copyable
+  vector<model*> shards;
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*****
+      sketch.cc
+      Approximate counts of patterns in a fixed amount of memory
+******/
+
+#include "sketch.hh"
+#include <climits>
+
+count_min_sketch::count_min_sketch(unsigned width, unsigned depth) {
+  this->width = 1;
+  while(this->width < width)
+    this->width *= 2;
+  this->depth = max(depth, 1u);
+  counters.assign(this->width*this->depth, 0);
+}
+
+//Row r uses h1 + r*h2 for its index (double hashing), which is as good as depth independent hashes for this purpose.
+//The pattern hash is mixed first, since FNV leaves the low bits poorly spread for short patterns.
+void count_min_sketch::find_counters(const pattern& p, vector<unsigned> &indices) const {
+  unsigned long long h = hash_pattern(p);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+
+  unsigned h1 = unsigned(h);
+  unsigned h2 = unsigned(h >> 32) | 1;
+  indices.resize(depth);
+  for(unsigned r = 0;r < depth;r++)
+    indices[r] = r*width + ((h1 + r*h2) & (width - 1));
+}
+
+unsigned count_min_sketch::add(const pattern& p) {
+  vector<unsigned> indices;
+  find_counters(p, indices);
+
+  unsigned short least = USHRT_MAX;
+  for(unsigned i : indices)
+    least = min(least, counters[i]);
+  if(least == USHRT_MAX)
+    return least;
+
+  for(unsigned i : indices) {
+    if(counters[i] == least)
+      counters[i]++;
+  }
+  return least + 1;
+}
+
+unsigned count_min_sketch::estimate(const pattern& p) const {
+  vector<unsigned> indices;
+  find_counters(p, indices);
+
+  unsigned short least = USHRT_MAX;
+  for(unsigned i : indices)
+    least = min(least, counters[i]);
+  return least;
+}
+
+//Sketches built with the same dimensions add counter by counter, so shards can each keep their own and merge later.
+void count_min_sketch::merge(const count_min_sketch& other) {
+  if(other.width != width || other.depth != depth) {
+    cout << "ERROR: tried to merge count-min sketches of different sizes.\n";
+    return;
+  }
+
+  for(unsigned i = 0;i < counters.size();i++)
+    counters[i] = min(unsigned(counters[i]) + other.counters[i], unsigned(USHRT_MAX));
+}
+
+void count_min_sketch::clear() {
+  counters.assign(counters.size(), 0);
+}
+
+unsigned long count_min_sketch::memory_used() const {
+  return counters.size()*sizeof(unsigned short);
+}
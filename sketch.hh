@@ -0,0 +1,36 @@
+/*****
+      sketch.hh
+      Approximate counts of patterns in a fixed amount of memory
+******/
+
+#include "pattern.hh"
+#include <vector>
+using namespace std;
+
+#ifndef SKETCH
+#define SKETCH
+
+/*
+  A count-min sketch: depth rows of width counters, each row indexed by a different hash of the pattern.
+  A pattern's estimate is the smallest of its counters.  Collisions only ever add to a counter, so the estimate is never
+  below the true count, and with width w it is over by more than 2N/w (N the total added) with probability at most
+  1/2^depth.  add() does a conservative update, raising only the counters at the minimum, which tightens that a lot.
+  Counters saturate instead of wrapping.
+  The memory used is fixed when the sketch is made, however many distinct patterns go through it.
+*/
+class count_min_sketch {
+public:
+  count_min_sketch(unsigned width = 1 << 16, unsigned depth = 4); //width is rounded up to a power of two
+  unsigned add(const pattern& p); //returns the new estimate
+  unsigned estimate(const pattern& p) const;
+  void merge(const count_min_sketch& other); //other must have the same width and depth
+  void clear();
+  unsigned long memory_used() const;
+private:
+  void find_counters(const pattern& p, vector<unsigned> &indices) const;
+  unsigned width;
+  unsigned depth;
+  vector<unsigned short> counters; //row r is counters[r*width] .. counters[(r + 1)*width - 1]
+};
+
+#endif
@@ -0,0 +1,131 @@
+/*****
+      snapshot.cc
+      On-disk format for saved models, and read-only mapping of saved files
+******/
+
+#include "snapshot.hh"
+#include <fstream>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static unsigned long long align8(unsigned long long offset) {
+  return (offset + 7) & ~7ull;
+}
+
+static void write_section(ofstream& file, unsigned long long offset, const void* data, unsigned long long bytes) {
+  static const char padding[8] = {0};
+  unsigned long long pos = file.tellp();
+  file.write(padding, offset - pos);
+  file.write((const char*)data, bytes);
+}
+
+//Lays out the sections after the header, fills in the layout fields of the header and writes the file.
+bool write_snapshot(const string& filename, snapshot_contents& contents) {
+  snapshot_header& h = contents.header;
+  memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+  h.format_version = SNAPSHOT_FORMAT_VERSION;
+  h.byte_order = SNAPSHOT_BYTE_ORDER;
+  h.header_bytes = sizeof(snapshot_header);
+  h.num_nodes = contents.nodes.size();
+  h.num_links = contents.links.size();
+  h.num_pattern_events = contents.pattern_p.size();
+
+  h.node_offset = align8(sizeof(snapshot_header));
+  h.pattern_p_offset = align8(h.node_offset + contents.nodes.size()*sizeof(snapshot_node));
+  h.pattern_dt_offset = align8(h.pattern_p_offset + contents.pattern_p.size());
+  h.link_begin_offset = align8(h.pattern_dt_offset + contents.pattern_dt.size()*sizeof(unsigned));
+  h.link_offset = align8(h.link_begin_offset + contents.link_begin.size()*sizeof(unsigned));
+  h.file_bytes = h.link_offset + contents.links.size()*sizeof(mn_link);
+
+  ofstream file(filename.c_str(), ios::out | ios::binary | ios::trunc);
+  if(!file.good()) {
+    cout << "ERROR: could not open " << filename << " to write a snapshot.\n";
+    return false;
+  }
+
+  file.write((const char*)&h, sizeof(h));
+  write_section(file, h.node_offset, contents.nodes.data(), contents.nodes.size()*sizeof(snapshot_node));
+  write_section(file, h.pattern_p_offset, contents.pattern_p.data(), contents.pattern_p.size());
+  write_section(file, h.pattern_dt_offset, contents.pattern_dt.data(), contents.pattern_dt.size()*sizeof(unsigned));
+  write_section(file, h.link_begin_offset, contents.link_begin.data(), contents.link_begin.size()*sizeof(unsigned));
+  write_section(file, h.link_offset, contents.links.data(), contents.links.size()*sizeof(mn_link));
+  file.close();
+
+  if(file.fail()) {
+    cout << "ERROR: failed writing the snapshot " << filename << ".\n";
+    return false;
+  }
+  return true;
+}
+
+//Member functions of the mapped snapshot
+mapped_snapshot::mapped_snapshot() {
+  base = NULL;
+  length = 0;
+}
+
+mapped_snapshot::~mapped_snapshot() {
+  close();
+}
+
+void mapped_snapshot::close() {
+  if(base != NULL)
+    munmap((void*)base, length);
+  base = NULL;
+  length = 0;
+}
+
+static bool section_fits(unsigned long long offset, unsigned long long bytes, unsigned long long length) {
+  return offset % 8 == 0 && offset <= length && bytes <= length - offset;
+}
+
+bool mapped_snapshot::open(const string& filename) {
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if(fd < 0) {
+    cout << "ERROR: could not open the snapshot " << filename << ".\n";
+    return false;
+  }
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (unsigned long long)st.st_size < sizeof(snapshot_header)) {
+    cout << "ERROR: " << filename << " is too short to be a snapshot.\n";
+    ::close(fd);
+    return false;
+  }
+
+  void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd); //the mapping holds its own reference to the file
+  if(mapping == MAP_FAILED) {
+    cout << "ERROR: could not map the snapshot " << filename << ".\n";
+    return false;
+  }
+  base = (const char*)mapping;
+  length = st.st_size;
+
+  const snapshot_header& h = header();
+  if(memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0) {
+    cout << "ERROR: " << filename << " is not a snapshot.\n";
+  } else if(h.byte_order != SNAPSHOT_BYTE_ORDER) {
+    cout << "ERROR: the snapshot " << filename << " was saved on a machine with a different byte order.\n";
+  } else if(h.format_version != SNAPSHOT_FORMAT_VERSION || h.header_bytes != sizeof(snapshot_header)) {
+    cout << "ERROR: the snapshot " << filename << " is format version " << h.format_version
+	 << "; this build reads version " << SNAPSHOT_FORMAT_VERSION << ".\n";
+  } else if(h.file_bytes != length
+	    || !section_fits(h.node_offset, (unsigned long long)h.num_nodes*sizeof(snapshot_node), length)
+	    || !section_fits(h.pattern_p_offset, h.num_pattern_events, length)
+	    || !section_fits(h.pattern_dt_offset, (unsigned long long)h.num_pattern_events*sizeof(unsigned), length)
+	    || !section_fits(h.link_begin_offset, ((unsigned long long)h.num_nodes + 1)*sizeof(unsigned), length)
+	    || !section_fits(h.link_offset, (unsigned long long)h.num_links*sizeof(mn_link), length)
+	    || link_begin()[h.num_nodes] != h.num_links) {
+    cout << "ERROR: the snapshot " << filename << " is truncated or corrupt.\n";
+  } else
+    return true;
+
+  close();
+  return false;
+}
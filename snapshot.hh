@@ -0,0 +1,97 @@
+/*****
+      snapshot.hh
+      On-disk format for saved models, and read-only mapping of saved files
+******/
+
+#include "model_node.hh"
+#include <string>
+#include <vector>
+using namespace std;
+
+#ifndef SNAPSHOT
+#define SNAPSHOT
+
+/*
+  A snapshot is a header followed by flat arrays, each starting on an 8 byte boundary:
+
+    node table    one snapshot_node per arena slot, released slots included, so node indices stay the same
+    pattern pool  the events of every pattern back to back: one byte of p per event, then one unsigned of dt per event
+    link_begin    num_nodes + 1 unsigneds: the CSR row starts of the super links
+    links         num_links mn_links
+
+  Nothing in the file is a pointer.  Patterns refer to the pool by event index and links refer to nodes by arena
+  index, so the file can be mapped at any address and the link arrays used where they lie.
+  Numbers are written in the byte order of the machine that saved them; a file from a machine of the other byte order
+  fails the byte_order check rather than loading garbage.
+  Bump SNAPSHOT_FORMAT_VERSION whenever the layout changes.
+*/
+const char SNAPSHOT_MAGIC[8] = {'P', 'O', 'S', 'I', 'T', 'M', 'D', 'L'};
+const unsigned SNAPSHOT_FORMAT_VERSION = 1;
+const unsigned SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+class snapshot_header {
+public:
+  char magic[8];
+  unsigned format_version;
+  unsigned byte_order;
+  unsigned header_bytes; //sizeof(snapshot_header) when written; catches a layout the reader does not expect
+  unsigned model_version;
+  unsigned num_nodes;
+  unsigned num_links;
+  unsigned num_pattern_events;
+  unsigned apex, training_set, base_case_0, base_case_1, root;
+  double total_num_events;
+  unsigned long long node_offset; //offsets are in bytes from the start of the file
+  unsigned long long pattern_p_offset;
+  unsigned long long pattern_dt_offset;
+  unsigned long long link_begin_offset;
+  unsigned long long link_offset;
+  unsigned long long file_bytes;
+};
+
+class snapshot_node {
+public:
+  double count;
+  unsigned patt_begin; //index of the first event of the pattern in the pattern pool
+  unsigned patt_size;
+  unsigned last_trained;
+  unsigned in_use;
+};
+
+//Everything a model_state writes, gathered up so the file can be laid out in one go.
+class snapshot_contents {
+public:
+  snapshot_header header; //the caller fills in the model fields; the layout fields are filled in by write_snapshot()
+  vector<snapshot_node> nodes;
+  vector<unsigned char> pattern_p;
+  vector<unsigned> pattern_dt;
+  vector<unsigned> link_begin;
+  vector<mn_link> links;
+};
+
+bool write_snapshot(const string& filename, snapshot_contents& contents);
+
+/*
+  A snapshot file mapped read-only into memory.  Pages are only read in as the arrays are touched, so opening even a
+  large snapshot is quick.  The mapping goes away with the object; share it through a shared_ptr to keep it alive
+  for as long as anything points into it.
+*/
+class mapped_snapshot {
+public:
+  mapped_snapshot();
+  ~mapped_snapshot();
+  bool open(const string& filename); //maps the file and checks the header and the section bounds
+  const snapshot_header& header() const { return *(const snapshot_header*)base; }
+  const snapshot_node* nodes() const { return (const snapshot_node*)(base + header().node_offset); }
+  const unsigned char* pattern_p() const { return (const unsigned char*)(base + header().pattern_p_offset); }
+  const unsigned* pattern_dt() const { return (const unsigned*)(base + header().pattern_dt_offset); }
+  const unsigned* link_begin() const { return (const unsigned*)(base + header().link_begin_offset); }
+  const mn_link* links() const { return (const mn_link*)(base + header().link_offset); }
+private:
+  mapped_snapshot(const mapped_snapshot&); //not copyable
+  void close();
+  const char* base;
+  unsigned long long length;
+};
+
+#endif
@@ -0,0 +1,122 @@
+/*****
+      task_pool.cc
+      A small work-stealing thread pool for fork-join parallelism
+******/
+
+#include "task_pool.hh"
+
+//Which pool, and which of its workers, the current thread is.  Outside threads have no pool.
+static thread_local const task_pool* current_pool = NULL;
+static thread_local unsigned current_worker = 0;
+
+task_pool::task_pool(unsigned num_threads) : pending(0) {
+  stopping = false;
+  for(unsigned i = 0;i < num_threads + 1;i++)
+    queues.push_back(new work_queue());
+  for(unsigned i = 0;i < num_threads;i++)
+    workers.push_back(thread([this, i]() { worker_loop(i); }));
+}
+
+//Every task_group must have finished waiting by now.
+task_pool::~task_pool() {
+  {
+    lock_guard<mutex> guard(sleep_lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for(thread& w : workers)
+    w.join();
+  for(work_queue* q : queues)
+    delete q;
+}
+
+int task_pool::own_queue() const {
+  if(current_pool == this)
+    return current_worker;
+  return workers.size();
+}
+
+void task_pool::push(const task& t) {
+  work_queue* q = queues[own_queue()];
+  {
+    lock_guard<mutex> guard(q->lock);
+    q->tasks.push_back(t);
+  }
+  pending.fetch_add(1);
+  {
+    lock_guard<mutex> guard(sleep_lock); //a worker about to sleep has either seen pending or will get the notify
+  }
+  wake.notify_one();
+}
+
+//Runs one task, from the calling thread's own queue if it has any, otherwise stolen.  False if there was none.
+bool task_pool::run_one() {
+  unsigned own = own_queue();
+  task t;
+  bool found = false;
+  for(unsigned i = 0;i < queues.size() && !found;i++) {
+    unsigned qi = (own + i) % queues.size();
+    work_queue* q = queues[qi];
+    lock_guard<mutex> guard(q->lock);
+    if(q->tasks.empty())
+      continue;
+
+    if(qi == own && own != workers.size()) {
+      t = q->tasks.back();
+      q->tasks.pop_back();
+    } else {
+      t = q->tasks.front();
+      q->tasks.pop_front();
+    }
+    found = true;
+  }
+  if(!found)
+    return false;
+
+  pending.fetch_sub(1);
+  t.fn();
+  t.group->outstanding.fetch_sub(1);
+  return true;
+}
+
+void task_pool::worker_loop(unsigned index) {
+  current_pool = this;
+  current_worker = index;
+  while(true) {
+    if(run_one())
+      continue;
+
+    unique_lock<mutex> guard(sleep_lock);
+    wake.wait(guard, [this]() { return stopping || pending.load() > 0; });
+    if(stopping)
+      return;
+  }
+}
+
+//Member functions of the task group
+task_group::task_group(task_pool& pool) : pool(pool), outstanding(0) {
+}
+
+task_group::~task_group() {
+  wait();
+}
+
+void task_group::run(const function<void()>& fn) {
+  if(pool.num_threads() == 0) {
+    fn();
+    return;
+  }
+
+  task_pool::task t;
+  t.fn = fn;
+  t.group = this;
+  outstanding.fetch_add(1);
+  pool.push(t);
+}
+
+void task_group::wait() {
+  while(outstanding.load() > 0) {
+    if(!pool.run_one())
+      this_thread::yield();
+  }
+}
@@ -0,0 +1,75 @@
+/*****
+      task_pool.hh
+      A small work-stealing thread pool for fork-join parallelism
+******/
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+using namespace std;
+
+#ifndef TASK_POOL
+#define TASK_POOL
+
+class task_group;
+
+/*
+  Every worker has a deque of its own.  A worker pushes the tasks it forks onto the back of its deque and pops from
+  the back, so it works depth first on what it just forked while the data is still in cache.  A worker with nothing
+  to do steals from the front of somebody else's deque, which is where the biggest, oldest pieces of work are.
+  Threads from outside the pool push onto a deque of their own that only gets stolen from.
+  A pool with no threads runs every task inline as it is forked.
+*/
+class task_pool {
+public:
+  task_pool(unsigned num_threads);
+  ~task_pool();
+  unsigned num_threads() const { return workers.size(); }
+private:
+  task_pool(const task_pool&); //not copyable
+  class task {
+  public:
+    function<void()> fn;
+    task_group* group;
+  };
+  class work_queue {
+  public:
+    mutex lock;
+    deque<task> tasks;
+  };
+  void push(const task& t);
+  bool run_one();
+  void worker_loop(unsigned index);
+  int own_queue() const; //index of the calling thread's queue
+  vector<thread> workers;
+  vector<work_queue*> queues; //one per worker, then the one for outside threads
+  atomic<unsigned> pending;
+  mutex sleep_lock;
+  condition_variable wake;
+  bool stopping;
+  friend class task_group;
+};
+
+/*
+  Tasks forked with run() may run on any thread, in any order, and may fork more tasks into the same group.
+  wait() returns once every one of them has finished.  The waiting thread runs tasks itself in the meantime rather
+  than blocking, so a task can fork and wait on a group of its own without tying up a worker.
+*/
+class task_group {
+public:
+  task_group(task_pool& pool);
+  ~task_group(); //waits
+  void run(const function<void()>& fn);
+  void wait();
+private:
+  task_group(const task_group&); //not copyable
+  task_pool& pool;
+  atomic<unsigned> outstanding;
+  friend class task_pool;
+};
+
+#endif
@@ -1,4 +1,7 @@
 #include <iostream>
+#include <sstream>
+#include <thread>
+#include <cmath>
 #include "configuration.hh"
 
 using namespace std;
@@ -35,6 +38,258 @@ completion_set dummy_func4(const pattern& p) {
   return cmp;
 }
 
+//Each completion is the tick after the last given, as likely as the givens were.  Every leaf ties, and ties go to the
+//newest leaf, so the tree grows down one path.
+unsigned max_givens_seen = 0;
+completion_set next_tick(const pattern& p) {
+  max_givens_seen = max(max_givens_seen, unsigned(p.size()));
+  completion_set cmp;
+  cmp.t_offset = (p.size() > 0 ? p.width() + 1 : 1);
+  cmp.event_prob = .5;
+  cmp.complement_prob = .5;
+  return cmp;
+}
+
+//Each completion is the tick after the last given, and an event there is a little more likely than not.  The
+//probabilities are joint ones, of the givens and the new event together, so every leaf of the tree is some product of
+//.6s and .4s and the leaves always sum to 1.
+vector<pattern> givens_asked;
+completion_set biased(const pattern& p) {
+  givens_asked.push_back(p);
+  double givens_prob = 1.0;
+  for(unsigned i = 1;i < p.p.size();i++) //the first given is the root's, which is certain
+    givens_prob *= (p.p[i] ? .6 : .4);
+  completion_set cmp;
+  cmp.t_offset = (p.size() > 0 ? p.width() + 1 : 1);
+  cmp.event_prob = givens_prob*.6;
+  cmp.complement_prob = givens_prob*.4;
+  return cmp;
+}
+
+//Probabilities that depend on the givens in no simple way, and that fall off fast enough that the children of a
+//leaf are always less likely than the leaves it was expanded alongside
+atomic<unsigned> scattered_calls(0);
+completion_set scattered(const pattern& p) {
+  scattered_calls++;
+  unsigned long h = hash_pattern(p);
+  double givens_prob = 1.0;
+  for(unsigned i = 1;i < p.p.size();i++)
+    givens_prob *= (p.p[i] ? .01 : .001);
+  completion_set cmp;
+  cmp.t_offset = (p.size() > 0 ? p.width() + 1 : 1) + h % 2;
+  cmp.event_prob = givens_prob*(.005 + (h % 5)*.001);
+  cmp.complement_prob = givens_prob*(.0005 + (h % 3)*.0001);
+  return cmp;
+}
+
+void scattered_batch(const pattern* givens, unsigned count, completion_set* completions) {
+  for(unsigned i = 0;i < count;i++)
+    completions[i] = scattered(givens[i]);
+}
+
+//The probability printed on each line of display_contents(), and whether the line is a leaf
+void line_probs(const string& str, vector<double>& probs, vector<bool>& leaves) {
+  stringstream lines(str);
+  string line;
+  while(getline(lines, line)) {
+    stringstream prob_str(line.substr(3));
+    double prob;
+    prob_str >> prob;
+    probs.push_back(prob);
+    leaves.push_back(line.compare(0, 3, "-->") != 0);
+  }
+}
+
+//The tree as display_contents() prints it
+string contents(configuration_space& s) {
+  stringstream out;
+  streambuf* old_buf = cout.rdbuf(out.rdbuf());
+  s.display_contents();
+  cout.rdbuf(old_buf);
+  return out.str();
+}
+
+unsigned count_lines(const string& str) {
+  return count(str.begin(), str.end(), '\n');
+}
+
+//Choosing events re-roots the space, and the givens never reach back further than the horizon
+void test_history_horizon() {
+  for(int horizon : {-1, 3}) {
+    configuration_space s;
+    s.set_history_horizon(horizon);
+    max_givens_seen = 0;
+    for(int i = 0;i < 20;i++) {
+      s.predict(4, 0, next_tick); //4 givens below the fulcrum, plus what is kept of the history: with a horizon of 3,
+				  //the fulcrum and the 3 ticks before it
+      s.choose_event();
+    }
+    cout << "horizon " << horizon << ": most givens asked about " << max_givens_seen << ", lines in the tree " << count_lines(contents(s)) << endl;
+  }
+
+  //turning the horizon on later re-roots the space right away
+  configuration_space s;
+  for(int i = 0;i < 5;i++) {
+    s.predict(10, 0, next_tick);
+    s.choose_event();
+  }
+  unsigned before = count_lines(contents(s));
+  s.set_history_horizon(INT_MAX);
+  unsigned after = count_lines(contents(s));
+  cout << "set_history_horizon after 5 events: lines in the tree " << before << " -> " << after << ", next event ready " << s.next_event_ready() << endl;
+}
+
+//The most likely leaf is expanded first, and of leaves that tie, the one added last
+void test_frontier_order() {
+  configuration_space s;
+  givens_asked.clear();
+  s.predict(6, 0, biased);
+  cout << "expansion order:" << endl;
+  for(const pattern& p : givens_asked) {
+    cout << "  ";
+    print_pattern(p);
+    cout << endl;
+  }
+
+  configuration_space ties;
+  max_givens_seen = 0;
+  ties.predict(5, 0, next_tick);
+  cout << "five expansions of tied leaves go " << max_givens_seen << " deep" << endl;
+}
+
+//Pairs that are freed are handed out again before the arena grows
+void test_config_arena() {
+  config_arena arena;
+  cn_index a = arena.alloc_pair();
+  cn_index b = arena.alloc_pair();
+  cout << "pairs " << a << " and " << b << ", live " << arena.live_count() << endl;
+  arena.free_pair(a);
+  cn_index c = arena.alloc_pair();
+  cout << "freed " << a << ", got back " << c << ", live " << arena.live_count() << endl;
+
+  vector<cn_index> pairs;
+  for(unsigned i = 0;i < CONFIG_SLAB_SIZE;i++) //two slabs' worth of nodes
+    pairs.push_back(arena.alloc_pair());
+  unsigned long bytes = arena.memory_used();
+  for(cn_index pair : pairs)
+    arena.free_pair(pair);
+  for(unsigned i = 0;i < CONFIG_SLAB_SIZE;i++)
+    arena.alloc_pair();
+  cout << "live after freeing and reallocating two slabs' worth " << arena.live_count() << ", arena grew " << (arena.memory_used() != bytes) << endl;
+}
+
+//predict stops once its time is up, however many expansions it was allowed
+void test_deadline() {
+  configuration_space s;
+  auto start = chrono::steady_clock::now();
+  unsigned expansions = s.predict(UINT_MAX, .05, [](const pattern& p) {
+      this_thread::sleep_for(chrono::microseconds(200));
+      return biased(p);
+    });
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  cout << "with a time limit of .05s: some expansions " << (expansions > 0) << ", stopped in time " << (elapsed >= .05 && elapsed < .5) << endl;
+
+  configuration_space untimed;
+  cout << "with no time limit, expansions " << untimed.predict(50, 0, biased) << endl;
+}
+
+//Rounds of leaves expanded on several threads make the same tree as one leaf at a time, given completions that keep
+//each round's children below the rest of the round.  predict_batched makes the same tree as well.
+void test_threaded_rounds() {
+  configuration_space serial;
+  serial.predict(300, 0, scattered);
+  string serial_tree = contents(serial);
+
+  bool same = true;
+  for(unsigned num_threads : {1, 2, 4}) {
+    configuration_space threaded;
+    threaded.set_expansion_threads(num_threads, 4);
+    threaded.predict(300, 0, scattered);
+    same = same && contents(threaded) == serial_tree;
+  }
+  cout << "threaded rounds match serial: " << same << endl;
+
+  configuration_space batched;
+  batched.predict_batched(300, 0, 8, scattered_batch);
+  cout << "predict_batched matches predict: " << (contents(batched) == serial_tree) << endl;
+  cout << "lines in the tree " << count_lines(serial_tree) << endl;
+}
+
+//Sums the leaves printed by display_contents(), and returns the root's probability.  They are printed to 6 digits.
+double leaf_sum(configuration_space& s, double& root_prob, unsigned& num_lines) {
+  vector<double> probs;
+  vector<bool> leaves;
+  line_probs(contents(s), probs, leaves);
+  double sum = 0.0;
+  for(unsigned i = 0;i < probs.size();i++) {
+    if(leaves[i])
+      sum += probs[i];
+  }
+  root_prob = probs[0];
+  num_lines = probs.size();
+  return sum;
+}
+
+//A beam prunes the lowest leaves, and pairs pruned on both sides fold into their parent, which keeps their sum
+void test_beam() {
+  double root_prob;
+  unsigned num_lines;
+  configuration_space full;
+  full.predict(300, 0, scattered);
+  double sum = leaf_sum(full, root_prob, num_lines);
+  cout << "no beam: lines in the tree " << num_lines << ", leaves sum to the root " << (fabs(sum - root_prob) <= 1e-4*root_prob) << endl;
+
+  configuration_space beamed;
+  beamed.set_beam(16);
+  beamed.predict(300, 0, scattered);
+  sum = leaf_sum(beamed, root_prob, num_lines);
+  cout << "beam of 16 leaves: lines in the tree " << num_lines << ", leaves sum to the root " << (fabs(sum - root_prob) <= 1e-4*root_prob) << endl;
+
+  //every new leaf under 5% of the root is pruned, so the tree runs out of leaves and folds all the way up to the
+  //children of the root, which is never pruned
+  configuration_space thresholded;
+  thresholded.set_beam(0, .05);
+  unsigned expansions = thresholded.predict(1000, 0, biased);
+  sum = leaf_sum(thresholded, root_prob, num_lines);
+  cout << "beam of 5%: expansions " << expansions << ", lines in the tree " << num_lines << ", root prob " << root_prob << ", leaves sum to " << sum << endl;
+  cout << "next event prob " << thresholded.next_event_cond_prob() << ", ready " << thresholded.next_event_ready() << endl;
+}
+
+//Givens seen before are answered from the cache, until it is invalidated
+void test_completion_cache() {
+  for(unsigned cache_size : {0, 1000}) {
+    configuration_space s;
+    s.set_completion_cache_size(cache_size);
+    s.set_history_horizon(0); //so the tree below each new fulcrum asks about the same givens as the one before it
+    scattered_calls = 0;
+    for(int i = 0;i < 10;i++) {
+      s.predict(30, 0, scattered);
+      s.choose_event();
+    }
+    unsigned calls = scattered_calls;
+    string tree = contents(s);
+    s.predict(30, 0, scattered);
+    unsigned calls_cached = scattered_calls - calls;
+    s.invalidate_completions();
+    s.predict(30, 0, scattered);
+    unsigned calls_invalidated = scattered_calls - calls - calls_cached;
+    cout << "cache of " << cache_size << ": calls for 300 expansions " << calls << ", for 30 more " << calls_cached << ", for 30 after invalidating " << calls_invalidated << ", lines in the tree " << count_lines(tree) << endl;
+  }
+}
+
+//A chain a hundred thousand deep, whose probability is recomputed without recursing
+void test_deep_chain() {
+  configuration_space s;
+  unsigned expansions = s.predict(100000, 0, [](const pattern& p) {
+      completion_set cmp;
+      cmp.t_offset = p.size(); //one event a tick, so this is the next one, without the walk width() takes
+      cmp.event_prob = .999;
+      cmp.complement_prob = .0001;
+      return cmp;
+    });
+  cout << "deep chain: expansions " << expansions << ", next event prob " << s.next_event_cond_prob() << endl;
+}
+
 int main() {
   configuration_space s;
   s.predict(1, 9999, dummy_func1);
@@ -56,6 +311,15 @@ int main() {
   s.choose_event();
   s.display_contents();
   cout << "next event ready?: " << s.next_event_ready() << endl;
+
+  test_history_horizon();
+  test_frontier_order();
+  test_config_arena();
+  test_deadline();
+  test_threaded_rounds();
+  test_beam();
+  test_completion_cache();
+  test_deep_chain();
   
   return 0;
 }
@@ -0,0 +1,55 @@
+#include "count_codec.hh"
+#include <iostream>
+
+using namespace std;
+
+//The largest relative error of a round trip through the codec, for values from lo up to hi by factors of step
+template<class codec> double max_relative_error(double lo, double hi, double step) {
+  double max_error = 0.0;
+  for(double value = lo;value <= hi;value *= step) {
+    double decoded = codec::decode(codec::encode(value));
+    max_error = max(max_error, fabs(decoded - value)/value);
+  }
+  return max_error;
+}
+
+int main() {
+
+  //fixed16_codec<2>: quarters are exact all the way up to the saturation point at 8191.75
+  typedef fixed16_codec<2> quarters;
+  bool exact = true;
+  for(double value = -8191.75;value <= 8191.75;value += 0.25)
+    exact = exact && (quarters::decode(quarters::encode(value)) == value);
+  cout << "fixed16<2> exact to a quarter up to 8191.75: " << exact << endl;
+  cout << "fixed16<2> saturates: " << quarters::decode(quarters::encode(1e6)) << " " << quarters::decode(quarters::encode(-1e6)) << endl;
+  cout << "fixed16<4> top of range: " << fixed16_codec<4>::decode(fixed16_codec<4>::encode(2047.9375)) << ", past it " << fixed16_codec<4>::decode(fixed16_codec<4>::encode(3000)) << endl;
+
+  //a count trained up to the top of the range one event at a time stays exact, then sticks there
+  quantized<quarters> count = 8180.0;
+  for(int i = 0;i < 11;i++)
+    count += 1.0;
+  cout << "fixed16<2> count 8180 + 11: " << double(count);
+  count += 1.0;
+  cout << ", + 1 more: " << double(count) << endl;
+
+  //log codecs: the stated relative error holds from 1 to the top of the range
+  cout << "log16 relative error under 0.07% up to 4e9: " << (max_relative_error<log16_codec>(1.0, 4e9, 1.01) < 0.0007) << endl;
+  cout << "log16 4e9: " << log16_codec::decode(log16_codec::encode(4e9)) << ", past the range " << log16_codec::decode(log16_codec::encode(1e12)) << endl;
+  cout << "log8 relative error under 9% up to 6e4: " << (max_relative_error<log8_codec>(1.0, 6e4, 1.01) < 0.09) << endl;
+  cout << "log8 6e4: " << log8_codec::decode(log8_codec::encode(6e4)) << ", past the range " << log8_codec::decode(log8_codec::encode(1e6)) << endl;
+  cout << "log16 zero: " << log16_codec::decode(log16_codec::encode(0.0)) << ", -1000: " << log16_codec::decode(log16_codec::encode(-1000.0)) << endl;
+
+  //as the class comment warns, a large log coded count rounds away an increment of 1
+  quantized<log16_codec> large = 1e9;
+  double before = large;
+  large += 1.0;
+  cout << "log16 1e9 + 1 unchanged: " << (double(large) == before) << endl;
+
+  //log_prob16_codec: the stated relative error holds down to 2^-31.99, below which it holds at the bottom code; zero
+  //and one are exact
+  cout << "log_prob16 relative error under 0.02% down to 2^-31.99: " << (max_relative_error<log_prob16_codec>(exp2(-31.99), 1.0, 1.01) < 0.0002) << endl;
+  cout << "log_prob16 2^-40 stored as 2^" << log2(log_prob16_codec::decode(log_prob16_codec::encode(exp2(-40.0)))) << endl;
+  cout << "log_prob16 zero: " << log_prob16_codec::decode(log_prob16_codec::encode(0.0)) << ", one: " << log_prob16_codec::decode(log_prob16_codec::encode(1.0)) << ", 2: " << log_prob16_codec::decode(log_prob16_codec::encode(2.0)) << endl;
+
+  return 0;
+}
@@ -0,0 +1,47 @@
+#include "log_prob.hh"
+#include <iostream>
+#include <cstdlib>
+
+using namespace std;
+
+int main() {
+
+  log_prob half = log_prob::from_double(0.5);
+  log_prob quarter = log_prob::from_double(0.25);
+  cout << "0.5*0.25: " << (half*quarter).to_double() << endl;
+  cout << "0.25/0.5: " << (quarter/half).to_double() << endl;
+  cout << "0.5 + 0.25: " << log_add(half, quarter).to_double() << endl;
+  cout << "0.5 - 0.25: " << log_sub(half, quarter).to_double() << endl;
+  cout << "0.25 - 0.5: " << log_sub(quarter, half).to_double() << endl;
+  cout << "0*0.5: " << (log_prob()*half).to_double() << ", 0.5/0: " << (half/log_prob()).to_log2() << endl;
+
+  //a product far below what a double can hold
+  log_prob tiny = log_prob::one();
+  for(int i = 0;i < 10000;i++)
+    tiny *= quarter;
+  cout << "0.25^10000: log2 " << tiny.to_log2() << endl;
+
+  //log_add against the exact sum, from equal terms out past where the correction term vanishes
+  double max_error = 0.0;
+  srand(1);
+  for(int i = 0;i < 100000;i++) {
+    double a = -100.0*rand()/RAND_MAX;
+    double b = a - 40.0*rand()/RAND_MAX;
+    double exact = exp2(a) + exp2(b);
+    double sum = log_add(log_prob::from_log2(a), log_prob::from_log2(b)).to_double();
+    double reversed = log_add(log_prob::from_log2(b), log_prob::from_log2(a)).to_double();
+    max_error = max(max_error, fabs(sum - exact)/exact);
+    max_error = max(max_error, fabs(reversed - exact)/exact);
+  }
+  cout << "log_add relative error under 1e-5: " << (max_error < 1e-5) << endl;
+
+  //a sum whose negative terms outweigh the positive ones comes out zero rather than negative
+  log_sum s;
+  s.add(half);
+  s.add(quarter, true);
+  cout << "0.5 - 0.25 as a log_sum: " << s.total().to_double() << endl;
+  s.add(half, true);
+  cout << "0.5 - 0.25 - 0.5 as a log_sum: " << s.total().to_double() << endl;
+
+  return 0;
+}
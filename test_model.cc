@@ -0,0 +1,184 @@
+#include "model.hh"
+#include "shard.hh"
+
+using namespace std;
+
+int main() {
+
+  //a period-3 stream, one event per tick
+  model m(0);
+  m.set_max_pattern_width(8);
+  occurrence first = get_occurrence(event(0, 1));
+  double untrained_prob = m.prob(first);
+  for(int t = 0;t < 60;t++)
+    m.train(event(t, (t % 3) == 0));
+  cout << "queries see the events before publish(): " << (m.prob(first) != untrained_prob) << endl;
+  m.publish();
+  cout << "queries see the events after publish(): " << (m.prob(first) != untrained_prob) << endl;
+
+  for(int t = 60;t < 63;t++) {
+    occurrence o1 = get_occurrence(event(t, 1));
+    occurrence o0 = get_occurrence(event(t, 0));
+    cout << "t " << t << ": log2 p(1) " << m.log2_prob(o1) << ", log2 p(0) " << m.log2_prob(o0) << endl;
+  }
+
+  //the batched query has to agree with the single ones
+  vector<occurrence> occs;
+  vector<double> probs;
+  for(int t = 57;t < 63;t++)
+    occs.push_back(get_occurrence(event(t, (t % 3) == 0)));
+  m.prob(occs, probs);
+  bool batch_ok = true;
+  for(unsigned i = 0;i < occs.size();i++)
+    batch_ok = batch_ok && (probs[i] == m.prob(occs[i]));
+  cout << "batched prob matches: " << batch_ok << endl;
+
+  occurrence givens;
+  givens.push_back(event(57, 1));
+  givens.push_back(event(58, 0));
+  givens.push_back(event(59, 0));
+  completion_set c = m.get_first_order_completions(givens);
+  cout << "completion t_offset " << c.t_offset << ", event_prob " << c.event_prob << ", complement_prob " << c.complement_prob << endl;
+
+  //walking in parallel gives the serial answers, whatever the threads and the fan out; only the order global_prob()
+  //adds its terms up in may change the last bits
+  vector<occurrence> three_event_occs;
+  vector<double> serial_log_probs;
+  for(int t = 48;t < 60;t++) {
+    occurrence three;
+    for(int dt = 0;dt < 3;dt++)
+      three.push_back(event(t + dt, ((t + 2*dt) % 3) == 0));
+    three_event_occs.push_back(three);
+    serial_log_probs.push_back(m.log2_prob(three));
+  }
+  for(unsigned num_threads : {1, 2, 4}) {
+    for(unsigned fan_out : {2, 3}) {
+      m.set_query_threads(num_threads, fan_out);
+      double max_diff = 0.0;
+      for(unsigned i = 0;i < three_event_occs.size();i++)
+	max_diff = max(max_diff, fabs(m.log2_prob(three_event_occs[i]) - serial_log_probs[i]));
+      cout << num_threads << " threads, fan out " << fan_out << ": parallel matches serial " << (max_diff < 1e-4) << endl;
+    }
+  }
+  m.set_query_threads(0);
+
+  //training in blocks builds the same model as training the same events one at a time, with or without a promotion
+  //threshold, so the queries come out exactly the same
+  auto block_stream = [](int t) { return (t % 3) == 0 || (t % 7) == 0; };
+  for(unsigned threshold : {1, 3}) {
+    model sequential(0);
+    sequential.set_max_pattern_width(6);
+    sequential.set_promotion_threshold(threshold);
+    for(int t = 0;t < 60;t++)
+      sequential.train(event(t, block_stream(t)));
+    sequential.publish();
+    for(int block_size : {5, 20, 60}) {
+      model blocks(0);
+      blocks.set_max_pattern_width(6);
+      blocks.set_promotion_threshold(threshold);
+      for(int t = 0;t < 60;t += block_size) {
+	vector<event> block;
+	for(int dt = 0;dt < block_size;dt++)
+	  block.push_back(event(t + dt, block_stream(t + dt)));
+	blocks.train(block);
+      }
+      blocks.publish();
+      bool same = true;
+      for(int t = 30;t < 63;t++) {
+	occurrence two;
+	two.push_back(event(t, block_stream(t)));
+	two.push_back(event(t + 2, block_stream(t + 2)));
+	same = same && blocks.log2_prob(two) == sequential.log2_prob(two);
+	for(bool p : {false, true})
+	  same = same && blocks.log2_prob(get_occurrence(event(t, p))) == sequential.log2_prob(get_occurrence(event(t, p)));
+      }
+      cout << "threshold " << threshold << ", blocks of " << block_size << ": same as one at a time " << same << endl;
+    }
+  }
+
+  //training in two halves and merging runs the same queries without trouble
+  model early(0), late(0);
+  early.set_max_pattern_width(8);
+  late.set_max_pattern_width(8);
+  for(int t = 0;t < 60;t++)
+    (t < 30 ? early : late).train(event(t, (t % 3) == 0));
+  late.merge(early);
+  late.publish();
+  occurrence o = get_occurrence(event(60, 1));
+  cout << "merged: log2 p(1) at 60 " << late.log2_prob(o) << endl;
+
+  //partitions of 5 ticks dealt round robin to 3 shards, so each shard trains on several stretches with gaps between
+  vector< vector<event> > partitions;
+  model whole(0);
+  whole.set_max_pattern_width(4);
+  for(int t = 0;t < 30;t++) {
+    if(t % 5 == 0)
+      partitions.push_back(vector<event>());
+    partitions.back().push_back(event(t, (t % 3) == 0));
+    whole.train(event(t, (t % 3) == 0));
+  }
+  whole.publish();
+  sharded_trainer trainer(3, 0);
+  trainer.set_max_pattern_width(4);
+  trainer.train(partitions);
+  model sharded(0);
+  sharded.set_max_pattern_width(4);
+  trainer.merge_into(sharded);
+  occurrence across; //straddles the edge between the first two partitions
+  across.push_back(event(3, 1));
+  across.push_back(event(6, 1));
+  cout << "round robin shards: log2 p(1) at 30 " << sharded.log2_prob(get_occurrence(event(30, 1))) << ", across a partition edge " << sharded.log2_prob(across) << endl;
+  cout << "one model: log2 p(1) at 30 " << whole.log2_prob(get_occurrence(event(30, 1))) << ", across a partition edge " << whole.log2_prob(across) << endl;
+
+  //three quarters of what the model takes unconstrained, which the training set alone fits in, under each eviction policy
+  auto constrained_stream = [](int t) { return (t % 7) == 0 || (t % 5) == 0; };
+  vector<occurrence> constrained_occs;
+  for(int t = 110;t < 120;t += 3) {
+    occurrence three;
+    for(int dt = 0;dt < 3;dt++)
+      three.push_back(event(t + dt, constrained_stream(t + dt)));
+    constrained_occs.push_back(three);
+  }
+  model unconstrained(0);
+  unconstrained.set_max_pattern_width(4);
+  for(int t = 0;t < 120;t++)
+    unconstrained.train(event(t, constrained_stream(t)));
+  unconstrained.publish();
+  cout << "unconstrained: log2 p";
+  for(const occurrence& occ : constrained_occs)
+    cout << " " << unconstrained.log2_prob(occ);
+  cout << endl;
+  unsigned constraint = unconstrained.memory_used()*3/4;
+  const char* policy_names[] = {"count", "recency", "information"};
+  for(eviction_policy policy : {EVICT_BY_COUNT, EVICT_BY_RECENCY, EVICT_BY_INFORMATION}) {
+    model constrained(constraint);
+    constrained.set_max_pattern_width(4);
+    constrained.set_eviction_policy(policy);
+    for(int t = 0;t < 120;t++)
+      constrained.train(event(t, constrained_stream(t)));
+    constrained.publish();
+    bool probs_ok = true;
+    cout << "evict by " << policy_names[policy] << ": within the constraint " << (constrained.memory_used() <= constraint) << ", log2 p";
+    for(const occurrence& occ : constrained_occs) {
+      double log2_p = constrained.log2_prob(occ);
+      probs_ok = probs_ok && isfinite(log2_p) && log2_p < 0.0;
+      cout << " " << log2_p;
+    }
+    cout << ", all probabilities between 0 and 1 " << probs_ok << endl;
+  }
+
+  //training in order only looks at the new event's neighborhood, so an event costs no more with a long history behind
+  //it than with a short one
+  model growing(0);
+  growing.set_max_pattern_width(6);
+  vector<double> block_seconds;
+  for(int block = 0;block < 8;block++) {
+    auto start = chrono::steady_clock::now();
+    for(int t = block*100;t < (block + 1)*100;t++)
+      growing.train(event(t, (t % 3) == 0));
+    block_seconds.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  }
+  cout << "events 700 to 800 train in under twice the time of events 100 to 200: " << (block_seconds[7] < 2*block_seconds[1]) << endl;
+
+  return 0;
+}
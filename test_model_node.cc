@@ -0,0 +1,119 @@
+#include <vector>
+#include <list>
+#include <iostream>
+#include <climits>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#define private public //so the visit_set epoch can be started just short of wrapping around
+#include "model_node.hh"
+#undef private
+
+using namespace std;
+
+//the super links of n, sorted so the order they are stored in does not matter
+vector<mn_link> supers_of(const model_node_arena& arena, mn_index n) {
+  vector<mn_link> supers;
+  arena.get_super_links(n, supers);
+  sort(supers.begin(), supers.end(), [](const mn_link& l1, const mn_link& l2) {
+      return l1.node < l2.node || (l1.node == l2.node && l1.t_offset < l2.t_offset);
+    });
+  return supers;
+}
+
+void print_supers(const model_node_arena& arena, mn_index n) {
+  cout << n << " (ref_count " << arena[n].ref_count << ") ->";
+  for(const mn_link& l : supers_of(arena, n))
+    cout << " " << l.node << "@" << l.t_offset;
+  cout << endl;
+}
+
+void print_arena(const model_node_arena& arena) {
+  for(mn_index n = 0;n < arena.size();n++) {
+    if(arena[n].in_use)
+      print_supers(arena, n);
+  }
+}
+
+int main() {
+
+  //visit_set: growth past the initial size, and reset
+  visit_set visited(16);
+  bool all_new = true;
+  for(mn_index n = 0;n < 1000;n++)
+    all_new = all_new && visited.insert(n, int(n) - 500);
+  bool all_found = true;
+  for(mn_index n = 0;n < 1000;n++)
+    all_found = all_found && visited.contains(n, int(n) - 500) && !visited.insert(n, int(n) - 500);
+  cout << "visit_set insert 1000: new " << all_new << ", found " << all_found << ", size " << visited.size() << endl;
+  cout << "visit_set contains (0, 0): " << visited.contains(0, 0) << endl;
+  visited.reset();
+  cout << "after reset: size " << visited.size() << ", contains (7, -493) " << visited.contains(7, -493) << endl;
+
+  //every reset stamps a new epoch; once the epoch wraps, the stamps from before must still read as empty
+  visit_set wrapped;
+  wrapped.insert(3, 4); //stamped with the first epoch, which comes around again after the wrap
+  wrapped.epoch = UINT_MAX; //as if it had been reset 2^32 - 2 times
+  wrapped.insert(5, 6);
+  cout << "last epoch before the wrap: contains (3, 4) " << wrapped.contains(3, 4) << ", contains (5, 6) " << wrapped.contains(5, 6) << endl;
+  wrapped.reset();
+  cout << "after the epoch wraps: contains (3, 4) " << wrapped.contains(3, 4) << ", insert (3, 4) " << wrapped.insert(3, 4) << endl;
+
+  //model_node_arena: links go in the overlay until compact() folds them in
+  model_node_arena arena;
+  for(int i = 0;i < 5;i++)
+    arena.create();
+  arena.add_super_link(1, mn_link(0, 0));
+  arena.add_super_link(2, mn_link(0, 3));
+  arena.add_super_link(3, mn_link(1, -1));
+  arena.add_super_link(3, mn_link(2, 2));
+  arena.add_super_link(4, mn_link(3, 0));
+  cout << "add an existing link: " << arena.add_super_link(4, mn_link(3, 0)) << endl;
+  cout << "overlay:" << endl;
+  print_arena(arena);
+  arena.compact();
+  cout << "compacted:" << endl;
+  print_arena(arena);
+
+  //removing a compacted link leaves a tombstone, which compact() drops
+  cout << "remove 3 -> 2@2: " << arena.remove_super_link(3, mn_link(2, 2)) << endl;
+  cout << "remove it again: " << arena.remove_super_link(3, mn_link(2, 2)) << endl;
+  arena.add_super_link(3, mn_link(0, 5));
+  cout << "tombstone and overlay:" << endl;
+  print_supers(arena, 3);
+  print_supers(arena, 2);
+  arena.compact();
+  cout << "compacted:" << endl;
+  print_supers(arena, 3);
+
+  //released slots are handed out again
+  arena.remove_super_links(4);
+  arena.release(4);
+  cout << "live after release: " << arena.live_count() << ", create reuses slot " << arena.create() << endl;
+
+  //restore() borrows the CSR arrays and rebuilds the reference counts from them
+  vector<unsigned> csr_begin;
+  vector<mn_link> csr_links;
+  for(mn_index n = 0;n < arena.size();n++) {
+    csr_begin.push_back(csr_links.size());
+    for(const mn_link& l : supers_of(arena, n))
+      csr_links.push_back(l);
+  }
+  csr_begin.push_back(csr_links.size());
+  vector<model_node> restored_nodes;
+  for(mn_index n = 0;n < arena.size();n++) {
+    restored_nodes.push_back(arena[n]);
+    restored_nodes.back().ref_count = 12345; //must not survive
+  }
+  model_node_arena restored;
+  restored.restore(restored_nodes, csr_begin.data(), csr_links.data(), shared_ptr<const void>(&csr_links, [](const void*) {}));
+  cout << "restored:" << endl;
+  print_arena(restored);
+
+  //the first write copies the borrowed arrays, leaving them as they were
+  restored.remove_super_link(1, mn_link(0, 0));
+  cout << "remove 1 -> 0@0 from the restored arena: ref_count of 0 is " << restored[0].ref_count << ", borrowed links unchanged " << (csr_links[csr_begin[1]] == mn_link(0, 0)) << endl;
+
+  return 0;
+}
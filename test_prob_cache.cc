@@ -0,0 +1,46 @@
+#include "prob_cache.hh"
+
+using namespace std;
+
+pattern make_pattern(int n) {
+  pattern p;
+  p.append(1, 0);
+  p.append(0, n + 1);
+  return p;
+}
+
+int main() {
+
+  shared_prob_cache cache(3);
+  log_prob prob;
+  for(int i = 0;i < 3;i++)
+    cache.insert(1, PROB_TERM, make_pattern(i), log_prob::from_double(1.0/(i + 2)));
+
+  //0 is used again, so 1 is the least recently used when 3 comes in
+  cout << "find 0: " << cache.find(1, PROB_TERM, make_pattern(0), prob) << " " << prob.to_double() << endl;
+  cache.insert(1, PROB_TERM, make_pattern(3), log_prob::from_double(0.2));
+  for(int i = 0;i < 4;i++)
+    cout << "after inserting 3, find " << i << ": " << cache.find(1, PROB_TERM, make_pattern(i), prob) << endl;
+
+  //the version and the kind are part of the key
+  cout << "find 0 at version 2: " << cache.find(2, PROB_TERM, make_pattern(0), prob) << endl;
+  cout << "find 0 as a global term: " << cache.find(1, GLOBAL_PROB_TERM, make_pattern(0), prob) << endl;
+
+  //shrinking evicts from the least recently used end
+  cache.resize(1);
+  cout << "after resize(1), find 3: " << cache.find(1, PROB_TERM, make_pattern(3), prob) << ", find 0: " << cache.find(1, PROB_TERM, make_pattern(0), prob) << endl;
+  cache.invalidate();
+  cout << "after invalidate, find 3: " << cache.find(1, PROB_TERM, make_pattern(3), prob) << endl;
+
+  //a memo remembers what it is given and passes it on to the shared cache
+  shared_prob_cache shared(16);
+  {
+    prob_memo memo(5, &shared);
+    memo.insert(GLOBAL_PROB_TERM, make_pattern(7), log_prob::from_double(0.125));
+    cout << "memo find: " << memo.find(GLOBAL_PROB_TERM, make_pattern(7), prob) << " " << prob.to_double() << endl;
+  }
+  prob_memo later(5, &shared);
+  cout << "later memo finds it through the shared cache: " << later.find(GLOBAL_PROB_TERM, make_pattern(7), prob) << " " << prob.to_double() << endl;
+
+  return 0;
+}
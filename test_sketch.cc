@@ -0,0 +1,56 @@
+#include "sketch.hh"
+
+using namespace std;
+
+int main() {
+
+  //a narrow sketch, so plenty of patterns collide
+  count_min_sketch sketch(64, 4);
+  vector<pattern> patts;
+  vector<unsigned> counts;
+  for(int i = 0;i < 500;i++) {
+    pattern p;
+    p.append(i & 1, 0);
+    p.append((i >> 1) & 1, 1 + i/4);
+    patts.push_back(p);
+    counts.push_back(1 + i % 7);
+  }
+  for(int round = 0;round < 7;round++) {
+    for(unsigned i = 0;i < patts.size();i++) {
+      if(round < int(counts[i]))
+	sketch.add(patts[i]);
+    }
+  }
+
+  //collisions only ever add, so no estimate is below the true count
+  bool no_undercount = true;
+  unsigned long total_over = 0;
+  for(unsigned i = 0;i < patts.size();i++) {
+    unsigned estimate = sketch.estimate(patts[i]);
+    no_undercount = no_undercount && estimate >= counts[i];
+    total_over += estimate - min(estimate, counts[i]);
+  }
+  cout << "no undercount: " << no_undercount << endl;
+  cout << "some overcount with 64 counters a row: " << (total_over > 0) << endl;
+
+  //merging two sketches adds the counts
+  count_min_sketch other(64, 4);
+  for(unsigned i = 0;i < patts.size();i++)
+    other.add(patts[i]);
+  sketch.merge(other);
+  bool merged_ok = true;
+  for(unsigned i = 0;i < patts.size();i++)
+    merged_ok = merged_ok && sketch.estimate(patts[i]) >= counts[i] + 1;
+  cout << "no undercount after merge: " << merged_ok << endl;
+
+  //a wide sketch is exact for a handful of patterns
+  count_min_sketch wide;
+  for(int i = 0;i < 3;i++)
+    wide.add(patts[0]);
+  wide.add(patts[1]);
+  cout << "wide: " << wide.estimate(patts[0]) << " " << wide.estimate(patts[1]) << " " << wide.estimate(patts[2]) << endl;
+  wide.clear();
+  cout << "cleared: " << wide.estimate(patts[0]) << endl;
+
+  return 0;
+}
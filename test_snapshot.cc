@@ -0,0 +1,55 @@
+#include "model.hh"
+#include "snapshot.hh"
+#include <cstdio>
+
+using namespace std;
+
+int main() {
+
+  const string filename = "test_snapshot.model";
+
+  model m(0);
+  m.set_max_pattern_width(6);
+  for(int t = 0;t < 40;t++)
+    m.train(event(t, (t % 4) == 1));
+  m.publish(); //save() writes the published version
+  cout << "save: " << m.save(filename) << endl;
+
+  //the file is laid out the way snapshot.hh says
+  mapped_snapshot mapped;
+  cout << "open: " << mapped.open(filename) << endl;
+  const snapshot_header& header = mapped.header();
+  cout << "format version " << header.format_version << ", byte order ok " << (header.byte_order == SNAPSHOT_BYTE_ORDER) << ", total_num_events " << header.total_num_events << endl;
+  cout << "sections in order: " << (header.node_offset < header.pattern_p_offset && header.pattern_p_offset <= header.pattern_dt_offset && header.pattern_dt_offset <= header.link_begin_offset && header.link_begin_offset < header.link_offset && header.link_offset <= header.file_bytes) << endl;
+  cout << "link_begin ends at num_links: " << (mapped.link_begin()[header.num_nodes] == header.num_links) << endl;
+
+  //a loaded model answers every query the way the saved one did, and keeps training from there
+  model loaded(0);
+  loaded.set_max_pattern_width(6);
+  cout << "load: " << loaded.load(filename) << endl;
+  bool same = true;
+  for(int t = 36;t < 44;t++) {
+    for(bool p : {false, true}) {
+      occurrence o = get_occurrence(event(t, p));
+      same = same && (m.prob(o) == loaded.prob(o));
+    }
+  }
+  cout << "same probs after load: " << same << endl;
+  m.train(event(40, 0));
+  loaded.train(event(40, 0));
+  m.publish();
+  loaded.publish();
+  occurrence o = get_occurrence(event(41, 1));
+  cout << "same probs after training both: " << (m.prob(o) == loaded.prob(o)) << endl;
+
+  //a missing or foreign file fails cleanly
+  model failed(0);
+  cout << "load a missing file: " << failed.load("no_such_file.model") << endl;
+  FILE* f = fopen(filename.c_str(), "r+b");
+  fputc('X', f);
+  fclose(f);
+  cout << "load a file with a bad magic number: " << failed.load(filename) << endl;
+  remove(filename.c_str());
+
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include "task_pool.hh"
+#include <iostream>
+
+using namespace std;
+
+//Sums 1..n by splitting the range in half and forking one half, so groups nest as deep as the recursion goes.
+void sum_range(task_pool& pool, unsigned long lo, unsigned long hi, atomic<unsigned long>& total) {
+  if(hi - lo <= 16) {
+    unsigned long sum = 0;
+    for(unsigned long i = lo;i < hi;i++)
+      sum += i;
+    total += sum;
+    return;
+  }
+  unsigned long mid = lo + (hi - lo)/2;
+  task_group group(pool);
+  group.run([&pool, lo, mid, &total]() { sum_range(pool, lo, mid, total); });
+  sum_range(pool, mid, hi, total);
+  group.wait();
+}
+
+int main() {
+
+  for(unsigned num_threads : {0u, 1u, 4u}) {
+    task_pool pool(num_threads);
+
+    //a task that forks a group of its own and waits on it, inside a group the caller waits on
+    atomic<unsigned> inner_runs(0);
+    atomic<unsigned> outer_done(0);
+    {
+      task_group outer(pool);
+      for(int i = 0;i < 8;i++) {
+	outer.run([&pool, &inner_runs, &outer_done]() {
+	    atomic<unsigned> runs(0);
+	    task_group inner(pool);
+	    for(int j = 0;j < 8;j++)
+	      inner.run([&runs, &inner_runs]() { runs++; inner_runs++; });
+	    inner.wait();
+	    if(runs == 8) //every task of this group has run by now, whatever the other groups are up to
+	      outer_done++;
+	  });
+      }
+      outer.wait();
+      cout << num_threads << " threads: inner tasks run " << inner_runs << ", outer tasks done " << outer_done << endl;
+    }
+
+    //tasks may fork more tasks into the group they are running in
+    atomic<unsigned> forked(0);
+    task_group group(pool);
+    group.run([&group, &forked]() {
+	for(int i = 0;i < 10;i++)
+	  group.run([&forked]() { forked++; });
+      });
+    group.wait();
+    cout << num_threads << " threads: tasks forked from a task " << forked << endl;
+
+    atomic<unsigned long> total(0);
+    sum_range(pool, 1, 100001, total);
+    cout << num_threads << " threads: recursive sum " << total << endl;
+  }
+
+  return 0;
+}